@@ -24,17 +24,41 @@
 // keeping their license for now.
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // syscall
 
 #include "pml.h"
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
 #include <assert.h>
+#include <stdatomic.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
+
+#ifdef __linux__
+	#include <sys/syscall.h>
+	#include <sys/inotify.h>
+	#include <linux/perf_event.h>
+	#include <sys/epoll.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	#define PML_AVX2
+	#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	#define PML_NEON
+	#include <arm_neon.h>
+#endif
 
 // Ideas:
 // - the number of dispatched events from pml_iterate, allowing
@@ -48,9 +72,7 @@
 // - aren't defer callbacks essentially timer callbacks with a time
 //   set to past timepoint (epoch 0)?
 //   would probably simplify library to treat them the same. Only good idea
-//   if it doesn't hurt performance though (atm timers aren't efficient).
-// - fd, timer and defer callbacks could probably be made mutable if there
-//   ever is a valid use case for it.
+//   if it doesn't hurt performance though.
 // - support less timer delay by preparing the nearest timespec instead
 //   of already calculating the resulting timeout interval.
 //   And then calculate the timeout from that at the end of prepare.
@@ -59,9 +81,6 @@
 //   Maybe change the custom interface to use timespec instead?
 //
 // Optimizations:
-// - implement the various caches and optimizations that keep track of
-//   timeouts etc: keep track of next timer while timers are created/changed so
-//   we don't have to iterate them in prepare
 // - keep a list of enabled defer events?
 // - rebuilding optimizations. On event source destruction
 //   we could just set the fds to -1 (and potentially even re-use
@@ -83,12 +102,85 @@ enum state {
 	state_preparing,
 	state_prepared,
 	state_polled,
+	state_dispatch_task,
 	state_dispatch_timer,
 	state_dispatch_io,
 	state_dispatch_defer,
 	state_dispatch_custom,
 };
 
+enum {
+	log_ring_size = 64,
+	log_msg_size = 128,
+};
+
+enum {
+	sampler_table_size = 256,
+};
+
+// The hardware events counted in perf mode, in the order of the
+// fields in pml_perf_counters.
+enum {
+	perf_cycles,
+	perf_instructions,
+	perf_cache_misses,
+	perf_branch_misses,
+	perf_n_events,
+};
+
+struct pml_timer {
+	struct pml_timer* prev;
+	struct pml_timer* next;
+	struct pml* pml;
+	// Deadline in nanoseconds of the clock.
+	int64_t time;
+	// The time the timer is ordered by in the heap. Always equal to time
+	// for non-lazy timers. For lazy timers, this may be earlier than time,
+	// and the timer might still be in the heap while disabled.
+	// The heap root is fixed up before it's used, see heap_fixup_root.
+	int64_t queue_time;
+	// Index of the heap of the timer's clock in pml.timer.heaps.
+	uint8_t clock_id;
+	bool enabled;
+	bool lazy;
+	// Whether the timer has expired and is waiting in pml.timer.pending
+	// (or the batch of its group) to be dispatched. In that case, queue_id
+	// is the index in the pending (or batch) array, otherwise the index in
+	// the heap of its clock (or UINT_MAX).
+	bool pending;
+	unsigned queue_id;
+	void* data;
+	pml_timer_cb cb;
+	struct pml_timer_group* group;
+};
+
+// Expired members are collected into batch. The group itself is
+// dispatched via the internal timer entry, which is put into the pending
+// array with the first collected member.
+// The data array passed to the callback is taken from the group for the
+// duration of the callback so that nested dispatching of the same group
+// can't overwrite it. Destroying the group during its callback is
+// deferred until the callback returns.
+struct pml_timer_group {
+	struct pml_timer_group* prev;
+	struct pml_timer_group* next;
+	struct pml* pml;
+	void* data;
+	pml_timer_group_cb cb;
+	struct pml_timer entry;
+	unsigned n_members;
+
+	struct pml_timer** batch;
+	unsigned n_batch;
+	unsigned cap_batch;
+
+	void** cb_data;
+	unsigned cap_cb_data;
+
+	unsigned running; // number of group callbacks on the stack
+	bool destroyed;
+};
+
 struct pml_io {
 	struct pml_io* prev;
 	struct pml_io* next;
@@ -98,17 +190,88 @@ struct pml_io {
 	int fd;
 	unsigned events;
 	unsigned fd_id;
+#ifdef __linux__
+	// See pml.tier. cold_id is the slot in pml.tier.slots while the io is
+	// cold (UINT_MAX otherwise), ready_id the index in pml.tier.ready.
+	uint64_t last_active; // iteration of the last callback
+	unsigned cold_id;
+	unsigned ready_id;
+	unsigned cold_revents;
+	bool no_cold; // fd isn't supported by epoll
+#endif
+	// When batched in the group, batch_id is the index in its batch
+	// and group_revents the revents to report. UINT_MAX otherwise.
+	struct pml_io_group* group;
+	unsigned batch_id;
+	unsigned group_revents;
+	bool sheddable; // see pml.lag
+	// Internal lazy timer for pml_io_set_deadline. Queued like any other
+	// timer but not part of the timer list, i.e. not visible as a source.
+	struct pml_timer deadline;
 };
 
-struct pml_timer {
-	struct pml_timer* prev;
-	struct pml_timer* next;
-	struct pml* pml;
-	struct timespec time;
+// Min-heap of the enabled timers of one clock, ordered by time.
+// With flat storage (see pml_set_timer_storage), timers is unordered
+// instead and deadlines holds the queue_time of the timer at the same
+// index in nanoseconds, so it can be scanned using SIMD instructions.
+// Lazy timers are applied immediately in that case, i.e. all queued
+// timers are enabled and have queue_time == time.
+struct timer_heap {
 	clockid_t clock;
-	bool enabled;
+	// Time of the clock when dispatching started in nanoseconds, used as
+	// time base for relative lazy timers. Only valid if now_valid is true.
+	int64_t now;
+	bool now_valid;
+	bool flat;
+	unsigned size;
+	unsigned cap;
+	struct pml_timer** timers;
+	int64_t* deadlines;
+};
+
+// Expired timer in flat storage, see collect_timers_flat.
+struct expired_timer {
+	struct pml_timer* timer;
+	struct timer_heap* heap;
+	int64_t late;
+};
+
+// Ready members are collected into batch during io dispatching, the
+// group is then queued in pml.io_group.ready. Like with timer groups,
+// the events array is detached from the group while its callback runs.
+// The spare array is used when the group is dispatched again from a
+// nested iteration during its callback. Both are reserved with
+// cap_events elements in pml_io_set_group; arrays with a smaller
+// capacity that come back from a callback are freed.
+struct pml_io_group {
+	struct pml_io_group* prev;
+	struct pml_io_group* next;
+	struct pml* pml;
 	void* data;
-	pml_timer_cb cb;
+	pml_io_group_cb cb;
+	unsigned n_members;
+
+	struct pml_io** batch;
+	unsigned n_batch;
+	unsigned cap_batch;
+
+	struct pml_io_event* events;
+	struct pml_io_event* spare;
+	unsigned cap_events;
+
+	struct pml_io_group* ready_next;
+	bool queued; // whether in pml.io_group.ready
+
+	unsigned running; // number of group callbacks on the stack
+	bool destroyed;
+};
+
+// A task scheduled with pml_schedule.
+struct task {
+	int64_t deadline;
+	uint64_t seq; // for FIFO order with equal deadlines
+	pml_task_fn fn;
+	void* arg;
 };
 
 struct pml_defer {
@@ -130,9 +293,37 @@ struct pml_custom {
 	unsigned n_fds_last;
 };
 
+struct pml_hook {
+	struct pml_hook* prev;
+	struct pml_hook* next;
+	struct pml* pml;
+	void* data;
+	pml_hook_cb cb;
+	enum pml_hook_type type;
+};
+
+#ifdef __linux__
+struct cold_slot {
+	struct pml_io* io; // NULL if unused
+	uint32_t gen;
+};
+
+struct pml_watch {
+	struct pml_watch* prev;
+	struct pml_watch* next;
+	struct pml_watch* bucket_next; // next watch in hash bucket
+	struct pml* pml;
+	void* data;
+	pml_watch_cb cb;
+	int wd; // -1 when removed by the kernel
+	unsigned mask;
+};
+#endif
+
 struct pml {
 	unsigned n_io; // only alive ones
 	unsigned n_fds;
+	unsigned cap_fds;
 	struct pollfd* fds;
 
 	struct {
@@ -140,9 +331,46 @@ struct pml {
 		struct pml_io* last;
 	} io;
 
+	// Groups with batched events are queued in ready and dispatched at
+	// the end of io dispatching, nested dispatching pops from the same queue.
+	struct {
+		struct pml_io_group* first;
+		struct pml_io_group* last;
+		struct pml_io_group* ready_first;
+		struct pml_io_group* ready_last;
+	} io_group;
+
 	struct {
 		struct pml_timer* first;
 		struct pml_timer* last;
+
+		// one heap per used clock. Heaps are never removed.
+		unsigned n_heaps;
+		struct timer_heap* heaps;
+
+		// Expired timers, collected at the start of timer dispatching in
+		// the order they are dispatched (most overdue first).
+		// Entries are unset when a timer is changed or destroyed before
+		// being dispatched. Nested dispatching continues at pending_pos.
+		struct pml_timer** pending;
+		unsigned n_pending;
+		unsigned cap_pending;
+		unsigned pending_pos;
+
+		unsigned dispatch_limit; // 0 for no limit
+
+		struct {
+			struct pml_timer_group* first;
+			struct pml_timer_group* last;
+		} group;
+
+		// pml_set_timer_storage. The scratch arrays are only used
+		// while collecting expired timers from flat storage.
+		bool flat;
+		unsigned* scratch_ids;
+		unsigned cap_scratch_ids;
+		struct expired_timer* scratch_expired;
+		unsigned cap_scratch_expired;
 	} timer;
 
 	struct {
@@ -150,16 +378,159 @@ struct pml {
 		struct pml_defer* last;
 	} defer;
 
+	// Scheduled tasks are kept in a min-heap by deadline. When dispatching
+	// starts, they are moved into run in the order they are called.
+	// Nested dispatching continues at run_pos.
+	struct {
+		struct task* heap;
+		unsigned n_heap;
+		unsigned cap_heap;
+
+		struct task* run;
+		unsigned n_run;
+		unsigned cap_run;
+		unsigned run_pos;
+
+		uint64_t seq;
+	} task;
+
 	struct {
 		struct pml_custom* first;
 		struct pml_custom* last;
 	} custom;
 
+	// one list per pml_hook_type
+	struct {
+		struct pml_hook* first;
+		struct pml_hook* last;
+	} hook[2];
+	// the next hook to run while running hooks, like state_data
+	struct pml_hook* hook_next;
+
+#ifdef __linux__
+	// Shared inotify state, created with the first watch.
+	// Watches are additionally kept in a hash table by their watch
+	// descriptor. The current event and the next watch to dispatch it
+	// to are stored here so a nested iteration can continue
+	// dispatching events where the outer one left off, see watch_io_cb.
+	struct {
+		struct pml_watch* first;
+		struct pml_watch* last;
+
+		int fd;
+		struct pml_io* io;
+		unsigned n_buckets; // power of two
+		unsigned n_watches;
+		struct pml_watch** buckets;
+
+		char* buf;
+		unsigned buf_size;
+		unsigned buf_off;
+
+		const struct inotify_event* event;
+		struct pml_watch* next;
+		bool next_all; // whether next iterates all watches or one bucket
+		// nesting level of watch_io_cb. The buckets are not rehashed
+		// while events are dispatched, since next might walk a bucket.
+		unsigned dispatching;
+	} watch;
+
+	// Hot/cold tiering of io sources, see pml_set_io_tiering.
+	// Cold ios are unlinked from the io list and registered in epfd
+	// instead, which occupies a single slot in fds (at fd_id, after the
+	// hot io sources). The epoll events refer to the cold ios by slot
+	// index and generation, so that stale events for destroyed ios
+	// (e.g. when their fd was dup'ed) can be detected.
+	// Ready cold ios are collected into ready at the start of io
+	// dispatching, nested dispatching continues at ready_pos.
+	struct {
+		unsigned cold_after; // 0 when disabled
+		uint64_t next_scan; // iteration of the next demotion scan
+		int epfd; // -1 until needed
+		unsigned fd_id;
+		unsigned n_cold;
+
+		struct cold_slot* slots;
+		unsigned n_slots;
+		unsigned cap_slots;
+		unsigned* free_slots;
+		unsigned n_free;
+
+		struct pml_io** ready;
+		unsigned n_ready;
+		unsigned cap_ready;
+		unsigned ready_pos;
+	} tier;
+#endif
+
+	// Lag monitor, see pml_set_lag_monitor. The lag is sampled in
+	// collect_timers as the lateness of the most overdue timer, the
+	// probe timer makes sure there is a sample regularly. The state is
+	// updated in pml_prepare, before the fds are built: while shedding,
+	// sheddable io sources are polled with no events.
+	// An idle mainloop can't lag, so the probe isn't re-armed when
+	// no other callback was dispatched since it was armed (work).
+	struct {
+		int64_t high; // in ns, 0 when disabled
+		int64_t low;
+		pml_lag_cb cb;
+		void* data;
+		bool shedding;
+		bool sampled; // since the last prepare
+		int64_t sample;
+		struct pml_timer probe;
+		uint64_t work;
+	} lag;
+
+	// pml_set_realtime. Instead of allocating, the arrays used while
+	// iterating are preallocated and locked, see grow.
+	// iteration_ns accumulates the time spent in prepare and dispatch
+	// (not polling) of the current iteration.
+	struct {
+		bool enabled;
+		int64_t prepare_start;
+		int64_t dispatch_start;
+		int64_t iteration_ns;
+		struct pml_realtime_stats stats;
+	} realtime;
+
+#ifdef __linux__
+	// Hardware counters, see pml_set_perf. All events are read at once
+	// from the group leader. Deltas are only attributed by the outermost
+	// prepare/poll/dispatch, the source type phases are switched with
+	// perf_switch while dispatching.
+	struct {
+		int leader; // -1 when disabled
+		int fds[perf_n_events]; // -1 if not available
+		unsigned n_events; // opened events
+		unsigned read_id[perf_n_events]; // index in the group read
+		int phase; // current dispatch phase, -1 for none
+		uint64_t last[perf_n_events]; // values at the last switch
+		struct pml_perf_counters counters[pml_perf_phase_count];
+	} perf;
+#endif
+
+	// fds of ios destroyed with pml_io_destroy_close, closed at the
+	// end of the outermost dispatch.
+	struct {
+		int* fds;
+		unsigned n_fds;
+		unsigned cap_fds;
+		bool no_range; // close_range isn't supported
+	} close;
+
 	bool rebuild_fds;
 	int n_enabled_defered;
 
 	int64_t prepared_timeout;
 
+	struct {
+		int64_t budget; // in ns, 0 when disabled
+		int64_t last_arrival; // in ns, CLOCK_MONOTONIC
+		int64_t interval; // average inter-arrival time, in ns
+		struct pml_busy_poll_stats stats;
+	} busy_poll;
+
 	// We mainly need this to continue dispatching events where we
 	// left off when dispatch is nested (re-entrancy).
 	// When in a dispatching state, state_data holds the next event
@@ -172,10 +543,38 @@ struct pml {
 	// a dispatch call). When using re-entrancy (only allowed for
 	// callbacks triggered from dispatch) this can get higher.
 	unsigned dispatch_depth;
+
+	// Counters, only accessed by the mainloop thread.
+	struct pml_stats stats;
+
+	// The counters published at the end of every pml_dispatch for
+	// pml_stats_read, protected by a seqlock: seq is odd while
+	// publishing. On its own cache line, so that readers on other
+	// threads don't cause false sharing with the mainloop state.
+	struct {
+		_Alignas(64) atomic_uint seq;
+		_Atomic uint64_t values[sizeof(struct pml_stats) / sizeof(uint64_t)];
+	} published;
+
+	// Log messages, see pml_log_drain. Single-producer (the mainloop
+	// thread), single-consumer ring: head is only written by the producer,
+	// tail only by the consumer. Messages are dropped when the ring is full.
+	struct {
+		pml_log_cb cb; // drains at the end of dispatch, if set
+		void* data;
+		_Alignas(64) atomic_uint head;
+		_Alignas(64) atomic_uint tail;
+		atomic_uint dropped;
+		char msgs[log_ring_size][log_msg_size];
+	} log;
 };
 
+_Static_assert(sizeof(struct pml_stats) % sizeof(uint64_t) == 0,
+	"pml_stats must only contain uint64_t");
+
 static bool is_dispatch_state(enum state state) {
 	return state == state_dispatch_io ||
+		state == state_dispatch_task ||
 		state == state_dispatch_defer ||
 		state == state_dispatch_custom ||
 		state == state_dispatch_timer;
@@ -185,221 +584,1545 @@ static unsigned min(unsigned a, unsigned b) {
 	return a < b ? a : b;
 }
 
-static int64_t timespec_ms(const struct timespec* t) {
-	return 1000 * t->tv_sec + t->tv_nsec / (1000 * 1000);
-}
+// Returns data, reallocated to hold at least n elements of the given size
+// if cap is smaller. All arrays used while iterating grow through this.
+// In realtime mode, growing means the preallocated capacity was too
+// small, which is treated as fatal error.
+static void* grow(struct pml* ml, void* data, unsigned* cap, unsigned n,
+		size_t size) {
+	if(n <= *cap) {
+		return data;
+	}
 
-static void timespec_subtract(struct timespec* a, const struct timespec* minus) {
-	a->tv_nsec -= minus->tv_nsec;
-	a->tv_sec -= minus->tv_sec;
-}
+	if(ml->realtime.enabled) {
+		fprintf(stderr, "pml: allocation in realtime mode (%u > %u)\n",
+			n, *cap);
+		abort();
+	}
 
-static void destroy_io(struct pml_io* io) {
-	assert(io);
-	if(io->next) io->next->prev = io->prev;
-	if(io->prev) io->prev->next = io->next;
-	if(io == io->pml->io.first) io->pml->io.first = io->next;
-	if(io == io->pml->io.last) io->pml->io.last = io->prev;
-	free(io);
-}
+	unsigned new_cap = *cap ? 2 * *cap : 16;
+	while(new_cap < n) {
+		new_cap *= 2;
+	}
 
-static void destroy_timer(struct pml_timer* t) {
-	assert(t);
-	if(t->next) t->next->prev = t->prev;
-	if(t->prev) t->prev->next = t->next;
-	if(t == t->pml->timer.first) t->pml->timer.first = t->next;
-	if(t == t->pml->timer.last) t->pml->timer.last = t->prev;
-	free(t);
+	*cap = new_cap;
+	return realloc(data, new_cap * size);
 }
 
-static void destroy_defer(struct pml_defer* d) {
-	assert(d);
-	if(d->next) d->next->prev = d->prev;
-	if(d->prev) d->prev->next = d->next;
-	if(d == d->pml->defer.first) d->pml->defer.first = d->next;
-	if(d == d->pml->defer.last) d->pml->defer.last = d->prev;
-	free(d);
+static void swap_elems(char* a, char* b, size_t size) {
+	for(size_t i = 0u; i < size; ++i) {
+		char tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
 }
 
-static void destroy_custom(struct pml_custom* c) {
-	assert(c);
-	if(c->next) c->next->prev = c->prev;
-	if(c->prev) c->prev->next = c->next;
-	if(c == c->pml->custom.first) c->pml->custom.first = c->next;
-	if(c == c->pml->custom.last) c->pml->custom.last = c->prev;
-	free(c);
-}
+static void sift_down(char* base, unsigned i, unsigned n, size_t size,
+		int (*cmp)(const void*, const void*)) {
+	while(2 * i + 1 < n) {
+		unsigned child = 2 * i + 1;
+		if(child + 1 < n &&
+				cmp(base + child * size, base + (child + 1) * size) < 0) {
+			++child;
+		}
 
-// mainloop
-struct pml* pml_new(void) {
-	struct pml* ml = calloc(1, sizeof(*ml));
-	return ml;
-}
+		if(cmp(base + i * size, base + child * size) >= 0) {
+			return;
+		}
 
-void pml_destroy(struct pml* ml) {
-	if(!ml) {
-		return;
+		swap_elems(base + i * size, base + child * size, size);
+		i = child;
 	}
+}
 
-	assert(ml->dispatch_depth == 0 &&
-		"Destroying a mainloop that is still dispatching");
-	if(ml->fds) {
-		free(ml->fds);
+// In-place heapsort with the interface of qsort. Used while iterating
+// instead of qsort, which may allocate a merge buffer (glibc does for
+// larger arrays), see pml_set_realtime.
+static void sort(void* data, unsigned n, size_t size,
+		int (*cmp)(const void*, const void*)) {
+	char* base = data;
+	for(unsigned i = n / 2; i-- > 0u;) {
+		sift_down(base, i, n, size, cmp);
 	}
 
-	// free all sources
-	for(struct pml_custom* c = ml->custom.first; c;) {
-		struct pml_custom* n = c->next;
-		free(c);
-		c = n;
+	for(unsigned end = n; end-- > 1u;) {
+		swap_elems(base, base + end * size, size);
+		sift_down(base, 0u, end, size, cmp);
 	}
-	for(struct pml_io* c = ml->io.first; c;) {
-		struct pml_io* n = c->next;
-		free(c);
-		c = n;
+}
+
+static int lock_range(bool lock, void* data, size_t size) {
+	if(!data || !size) {
+		return 0;
 	}
-	for(struct pml_defer* c = ml->defer.first; c;) {
-		struct pml_defer* n = c->next;
-		free(c);
-		c = n;
+	return lock ? mlock(data, size) : munlock(data, size);
+}
+
+// Locks (or unlocks) the mainloop and the preallocated arrays.
+// Returns the first error.
+static int lock_arrays(struct pml* ml, bool lock) {
+	int res = lock_range(lock, ml, sizeof(*ml));
+	res |= lock_range(lock, ml->fds, ml->cap_fds * sizeof(*ml->fds));
+	res |= lock_range(lock, ml->timer.heaps,
+		ml->timer.n_heaps * sizeof(*ml->timer.heaps));
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		res |= lock_range(lock, h->timers, h->cap * sizeof(*h->timers));
+		res |= lock_range(lock, h->deadlines, h->cap * sizeof(*h->deadlines));
 	}
-	for(struct pml_timer* c = ml->timer.first; c;) {
-		struct pml_timer* n = c->next;
-		free(c);
-		c = n;
+
+	res |= lock_range(lock, ml->timer.pending,
+		ml->timer.cap_pending * sizeof(*ml->timer.pending));
+	res |= lock_range(lock, ml->timer.scratch_ids,
+		ml->timer.cap_scratch_ids * sizeof(*ml->timer.scratch_ids));
+	res |= lock_range(lock, ml->timer.scratch_expired,
+		ml->timer.cap_scratch_expired * sizeof(*ml->timer.scratch_expired));
+	res |= lock_range(lock, ml->task.heap,
+		ml->task.cap_heap * sizeof(*ml->task.heap));
+	res |= lock_range(lock, ml->task.run,
+		ml->task.cap_run * sizeof(*ml->task.run));
+#ifdef __linux__
+	res |= lock_range(lock, ml->tier.slots,
+		ml->tier.cap_slots * sizeof(*ml->tier.slots));
+	res |= lock_range(lock, ml->tier.free_slots,
+		ml->tier.cap_slots * sizeof(*ml->tier.free_slots));
+	res |= lock_range(lock, ml->tier.ready,
+		ml->tier.cap_ready * sizeof(*ml->tier.ready));
+#endif
+	return res;
+}
+
+// Returns a + b, saturated instead of overflowing.
+static int64_t add_ns(int64_t a, int64_t b) {
+	if(b > 0 && a > INT64_MAX - b) {
+		return INT64_MAX;
+	} else if(b < 0 && a < INT64_MIN - b) {
+		return INT64_MIN;
 	}
 
-	free(ml);
+	return a + b;
 }
 
-void pml_prepare(struct pml* ml) {
-	assert(ml);
-	assert((ml->state == state_none || is_dispatch_state(ml->state)) &&
-		"Invalid state of mainloop for pml_prepare");
+// Returns a - b, saturated instead of overflowing.
+static int64_t sub_ns(int64_t a, int64_t b) {
+	if(b < 0 && a > INT64_MAX + b) {
+		return INT64_MAX;
+	} else if(b > 0 && a < INT64_MIN + b) {
+		return INT64_MIN;
+	}
 
-	// dispatching isn't finished yet, just continue it
-	// pml_poll will detect that as well, but we set the timeout
-	// to zero so we can return it from pml_query
-	if(ml->state != state_none) {
-		ml->prepared_timeout = 0;
-		return;
+	return a - b;
+}
+
+// Saturates at INT64_MIN and INT64_MAX, i.e. about 292 years from the
+// epoch of the clock. Such deadlines are never reached anyway.
+static int64_t timespec_ns(const struct timespec* t) {
+	const int64_t ns_per_sec = 1000 * 1000 * 1000;
+	if(t->tv_sec > INT64_MAX / ns_per_sec) {
+		return INT64_MAX;
+	} else if(t->tv_sec < INT64_MIN / ns_per_sec) {
+		return INT64_MIN;
 	}
 
-	ml->state = state_preparing;
+	return add_ns(ns_per_sec * (int64_t) t->tv_sec, t->tv_nsec);
+}
 
-	ml->prepared_timeout = -1;
-	if(ml->n_enabled_defered) {
-		ml->prepared_timeout = 0;
+static int64_t now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_ns(&now);
+}
+
+// Returns a normalized timespec, i.e. 0 <= tv_nsec < 1e9.
+static struct timespec ns_timespec(int64_t ns) {
+	int64_t sec = ns / (1000 * 1000 * 1000);
+	int64_t nsec = ns % (1000 * 1000 * 1000);
+	if(nsec < 0) {
+		nsec += 1000 * 1000 * 1000;
+		--sec;
 	}
 
-	// prepare custom sources
-	unsigned n_fds = ml->n_io;
-	for(struct pml_custom* c = ml->custom.first; c; c = c->next) {
-		if(c->impl->prepare) {
-			c->impl->prepare(c);
-		}
+	struct timespec ret = {.tv_sec = (time_t) sec, .tv_nsec = (long) nsec};
+	return ret;
+}
 
-		unsigned count = 0;
-		struct pollfd* fds = NULL;
-		if(!ml->rebuild_fds && n_fds < ml->n_fds) {
-			fds = &ml->fds[n_fds];
-			count = ml->n_fds - n_fds;
-		}
+// Timers with a deadline closer than this are considered expired,
+// i.e. when the timeout for poll would be 0ms.
+static const int64_t timer_slack_ns = 1000 * 1000;
 
-		int timeout;
-		count = c->impl->query(c, fds, count, &timeout);
-		assert(timeout >= -1);
+static bool timer_less(const struct pml_timer* a, const struct pml_timer* b) {
+	return a->queue_time < b->queue_time;
+}
 
-		if(timeout != -1 && (ml->prepared_timeout == -1 ||
-				timeout < ml->prepared_timeout)) {
-			ml->prepared_timeout = timeout;
+// Returns the smallest of the n deadlines, INT64_MAX if n is 0.
+static int64_t deadline_min_scalar(const int64_t* d, unsigned n) {
+	int64_t ret = INT64_MAX;
+	for(unsigned i = 0u; i < n; ++i) {
+		ret = d[i] < ret ? d[i] : ret;
+	}
+	return ret;
+}
+
+// Writes the indices of the deadlines <= limit to out, returns their count.
+static unsigned deadline_expired_scalar(const int64_t* d, unsigned n,
+		int64_t limit, unsigned* out) {
+	unsigned count = 0u;
+	for(unsigned i = 0u; i < n; ++i) {
+		if(d[i] <= limit) {
+			out[count++] = i;
 		}
+	}
+	return count;
+}
 
-		c->n_fds_last = count;
-		n_fds += count;
+#ifdef PML_AVX2
+__attribute__((target("avx2")))
+static int64_t deadline_min_avx2(const int64_t* d, unsigned n) {
+	__m256i min = _mm256_set1_epi64x(INT64_MAX);
+	unsigned i = 0u;
+	for(; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) &d[i]);
+		min = _mm256_blendv_epi8(min, v, _mm256_cmpgt_epi64(min, v));
 	}
 
-	// timers
-	struct timespec now;
-	clockid_t clk = CLOCK_REALTIME;
-	clock_gettime(clk, &now);
-	for(struct pml_timer* t = ml->timer.first; t; t = t->next) {
-		if(!t->enabled) {
-			continue;
-		}
+	int64_t lanes[4];
+	_mm256_storeu_si256((__m256i*) lanes, min);
+	int64_t ret = deadline_min_scalar(lanes, 4);
+	int64_t rest = deadline_min_scalar(&d[i], n - i);
+	return rest < ret ? rest : ret;
+}
 
-		if(t->clock != clk) {
-			clockid_t clk = t->clock;
-			clock_gettime(clk, &now);
+__attribute__((target("avx2")))
+static unsigned deadline_expired_avx2(const int64_t* d, unsigned n,
+		int64_t limit, unsigned* out) {
+	__m256i vlimit = _mm256_set1_epi64x(limit);
+	unsigned count = 0u;
+	unsigned i = 0u;
+	for(; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) &d[i]);
+		__m256i later = _mm256_cmpgt_epi64(v, vlimit);
+		unsigned mask = ~(unsigned) _mm256_movemask_pd(
+			_mm256_castsi256_pd(later)) & 0xFu;
+		while(mask) {
+			out[count++] = i + (unsigned) __builtin_ctz(mask);
+			mask &= mask - 1;
 		}
+	}
 
-		struct timespec diff = t->time;
-		timespec_subtract(&diff, &now);
-		int64_t ms = timespec_ms(&diff);
-		if(ms < 0) {
-			ml->prepared_timeout = 0;
-		} else if(ml->prepared_timeout == -1 || ms < ml->prepared_timeout) {
-			ml->prepared_timeout = ms;
+	for(; i < n; ++i) {
+		if(d[i] <= limit) {
+			out[count++] = i;
 		}
 	}
+	return count;
+}
+#endif // PML_AVX2
+
+#ifdef PML_NEON
+static int64_t deadline_min_neon(const int64_t* d, unsigned n) {
+	int64x2_t min = vdupq_n_s64(INT64_MAX);
+	unsigned i = 0u;
+	for(; i + 2 <= n; i += 2) {
+		int64x2_t v = vld1q_s64(&d[i]);
+		min = vbslq_s64(vcltq_s64(v, min), v, min);
+	}
 
-	// rebuild fds if needed
-	if(ml->rebuild_fds || n_fds > ml->n_fds) {
-		ml->rebuild_fds = false;
-		ml->fds = realloc(ml->fds, n_fds * sizeof(*ml->fds));
-		ml->n_fds = n_fds;
-
-		unsigned i = 0u;
-		for(struct pml_io* io = ml->io.first; io; io = io->next) {
-			ml->fds[i].fd = io->fd;
-			ml->fds[i].events = io->events;
-			io->fd_id = i;
-			++i;
-		}
+	int64_t a = vgetq_lane_s64(min, 0);
+	int64_t b = vgetq_lane_s64(min, 1);
+	int64_t ret = a < b ? a : b;
+	int64_t rest = deadline_min_scalar(&d[i], n - i);
+	return rest < ret ? rest : ret;
+}
 
-		for(struct pml_custom* c = ml->custom.first; c; c = c->next) {
-			int timeout;
-			unsigned count = c->impl->query(c, &ml->fds[i], c->n_fds_last, &timeout);
-			assert(count == c->n_fds_last &&
-				"Custom event source changed number of fds without prepare");
+static unsigned deadline_expired_neon(const int64_t* d, unsigned n,
+		int64_t limit, unsigned* out) {
+	int64x2_t vlimit = vdupq_n_s64(limit);
+	unsigned count = 0u;
+	unsigned i = 0u;
+	for(; i + 2 <= n; i += 2) {
+		uint64x2_t le = vcleq_s64(vld1q_s64(&d[i]), vlimit);
+		if(vgetq_lane_u64(le, 0)) out[count++] = i;
+		if(vgetq_lane_u64(le, 1)) out[count++] = i + 1;
+	}
 
-			c->fds_id = i;
-			i += count;
+	for(; i < n; ++i) {
+		if(d[i] <= limit) {
+			out[count++] = i;
 		}
+	}
+	return count;
+}
+#endif // PML_NEON
 
-		assert(i == ml->n_fds);
+// Runtime dispatch: NEON is always available on aarch64, AVX2 is checked.
+static int64_t deadline_min(const int64_t* d, unsigned n) {
+#if defined(PML_AVX2)
+	if(__builtin_cpu_supports("avx2")) {
+		return deadline_min_avx2(d, n);
 	}
+#elif defined(PML_NEON)
+	return deadline_min_neon(d, n);
+#endif
+	return deadline_min_scalar(d, n);
+}
 
-	assert(ml->state == state_preparing);
-	ml->state = state_prepared;
-	return;
+static unsigned deadline_expired(const int64_t* d, unsigned n,
+		int64_t limit, unsigned* out) {
+#if defined(PML_AVX2)
+	if(__builtin_cpu_supports("avx2")) {
+		return deadline_expired_avx2(d, n, limit, out);
+	}
+#elif defined(PML_NEON)
+	return deadline_expired_neon(d, n, limit, out);
+#endif
+	return deadline_expired_scalar(d, n, limit, out);
 }
 
-int pml_poll(struct pml* ml, int timeout) {
-	assert(ml);
-	assert((ml->state == state_prepared || is_dispatch_state(ml->state)) &&
-		"Invalid mainloop state for calling pml_poll");
+static void heap_set(struct timer_heap* h, unsigned i, struct pml_timer* t) {
+	h->timers[i] = t;
+	t->queue_id = i;
+	if(h->flat) {
+		h->deadlines[i] = t->queue_time;
+	}
+}
 
-	// dispatching not finished yet, we can skip polling.
-	if(ml->state != state_prepared) {
-		return 0;
+// For flat storage, heap_up and heap_down only update the deadline.
+static void heap_up(struct timer_heap* h, unsigned i) {
+	struct pml_timer* t = h->timers[i];
+	if(h->flat) {
+		heap_set(h, i, t);
+		return;
 	}
 
-	int ret;
-	// we ignore incoming signals
-	do {
-		ret = poll(ml->fds, ml->n_fds, timeout);
-	} while(ret < 0 && errno == EINTR);
+	while(i > 0) {
+		unsigned parent = (i - 1) / 2;
+		if(!timer_less(t, h->timers[parent])) {
+			break;
+		}
 
-	if(ret < 0) {
-		fprintf(stderr, "pml_poll: %s (%d)\n", strerror(errno), errno);
+		heap_set(h, i, h->timers[parent]);
+		i = parent;
 	}
 
-	ml->state = state_polled;
-	return ret;
+	heap_set(h, i, t);
 }
 
-static bool dispatch_defer(struct pml* ml) {
+static void heap_down(struct timer_heap* h, unsigned i) {
+	struct pml_timer* t = h->timers[i];
+	if(h->flat) {
+		heap_set(h, i, t);
+		return;
+	}
+
+	while(true) {
+		unsigned child = 2 * i + 1;
+		if(child >= h->size) {
+			break;
+		}
+
+		if(child + 1 < h->size &&
+				timer_less(h->timers[child + 1], h->timers[child])) {
+			++child;
+		}
+
+		if(!timer_less(h->timers[child], t)) {
+			break;
+		}
+
+		heap_set(h, i, h->timers[child]);
+		i = child;
+	}
+
+	heap_set(h, i, t);
+}
+
+static void heap_remove(struct timer_heap* h, unsigned i) {
+	assert(i < h->size);
+	h->timers[i]->queue_id = UINT_MAX;
+	if(i == --h->size) {
+		return;
+	}
+
+	heap_set(h, i, h->timers[h->size]);
+	if(h->flat) {
+		return;
+	}
+
+	heap_up(h, i);
+	heap_down(h, h->timers[i]->queue_id);
+}
+
+// Makes sure there is space for one more timer.
+static void heap_reserve(struct pml* ml, struct timer_heap* h) {
+	if(h->size < h->cap) {
+		return;
+	}
+
+	unsigned cap = h->cap;
+	h->timers = grow(ml, h->timers, &cap, h->size + 1, sizeof(*h->timers));
+	if(h->flat) {
+		h->deadlines = realloc(h->deadlines, cap * sizeof(*h->deadlines));
+	}
+	h->cap = cap;
+}
+
+// Returns the index of the timer with the earliest queue_time.
+static unsigned heap_root(struct timer_heap* h) {
+	assert(h->size);
+	if(!h->flat) {
+		return 0u;
+	}
+
+	int64_t min = deadline_min(h->deadlines, h->size);
+	unsigned i = 0u;
+	while(h->deadlines[i] != min) {
+		++i;
+	}
+	return i;
+}
+
+// Returns the index of the heap for the given clock, creating it if needed.
+static uint8_t get_heap_id(struct pml* ml, clockid_t clock) {
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		if(ml->timer.heaps[i].clock == clock) {
+			return (uint8_t) i;
+		}
+	}
+
+	assert(ml->timer.n_heaps < UINT8_MAX && "Too many clocks");
+	++ml->timer.n_heaps;
+	ml->timer.heaps = realloc(ml->timer.heaps,
+		ml->timer.n_heaps * sizeof(*ml->timer.heaps));
+	struct timer_heap* h = &ml->timer.heaps[ml->timer.n_heaps - 1];
+	*h = (struct timer_heap) {.clock = clock, .flat = ml->timer.flat};
+	return (uint8_t) (ml->timer.n_heaps - 1);
+}
+
+static struct timer_heap* timer_heap(struct pml_timer* t) {
+	return &t->pml->timer.heaps[t->clock_id];
+}
+
+// Removes the timer from its heap or the pending list.
+static void timer_unqueue(struct pml_timer* t) {
+	struct pml* ml = t->pml;
+	if(t->pending && t->group) {
+		t->group->batch[t->queue_id] = NULL;
+		t->pending = false;
+		t->queue_id = UINT_MAX;
+	} else if(t->pending) {
+		ml->timer.pending[t->queue_id] = NULL;
+		t->pending = false;
+		t->queue_id = UINT_MAX;
+	} else if(t->queue_id != UINT_MAX) {
+		heap_remove(timer_heap(t), t->queue_id);
+	}
+}
+
+// Inserts the enabled timer into the heap of its clock.
+static void timer_queue(struct pml_timer* t) {
+	assert(t->enabled && !t->pending && t->queue_id == UINT_MAX);
+	struct timer_heap* h = timer_heap(t);
+	heap_reserve(t->pml, h);
+	t->queue_time = t->time;
+	heap_set(h, h->size++, t);
+	heap_up(h, t->queue_id);
+}
+
+// Applies the changes of lazy timers at the root of the heap, i.e.
+// removes disabled ones and re-orders the ones whose time was
+// moved back. Returns the next timer to expire, if any.
+static struct pml_timer* heap_fixup_root(struct timer_heap* h) {
+	while(h->size) {
+		unsigned i = heap_root(h);
+		struct pml_timer* t = h->timers[i];
+		if(!t->enabled) {
+			heap_remove(h, i);
+		} else if(t->time != t->queue_time) {
+			t->queue_time = t->time;
+			heap_down(h, i);
+		} else {
+			return t;
+		}
+	}
+
+	return NULL;
+}
+
+static void timer_set(struct pml_timer* t, int64_t time) {
+	// lazy timers that are still in the heap only have to be moved
+	// if the time gets earlier. Moving them is cheap with flat storage.
+	if(t->lazy && !t->pending && t->queue_id != UINT_MAX) {
+		struct timer_heap* h = timer_heap(t);
+		t->enabled = true;
+		t->time = time;
+		if(h->flat || time < t->queue_time) {
+			t->queue_time = time;
+			heap_up(h, t->queue_id);
+		}
+		return;
+	}
+
+	timer_unqueue(t);
+	t->enabled = true;
+	t->time = time;
+	timer_queue(t);
+}
+
+static void unlink_io(struct pml_io* io) {
+	assert(io);
+	if(io->next) io->next->prev = io->prev;
+	if(io->prev) io->prev->next = io->next;
+	if(io == io->pml->io.first) io->pml->io.first = io->next;
+	if(io == io->pml->io.last) io->pml->io.last = io->prev;
+	io->next = io->prev = NULL;
+}
+
+static void link_io(struct pml_io* io) {
+	struct pml* ml = io->pml;
+	if(!ml->io.first) {
+		ml->io.first = io;
+	} else {
+		ml->io.last->next = io;
+		io->prev = ml->io.last;
+	}
+	ml->io.last = io;
+}
+
+static void destroy_io(struct pml_io* io) {
+	unlink_io(io);
+	free(io);
+}
+
+#ifdef __linux__
+// Moves the io into the epoll set. Returns false if epoll doesn't
+// support its fd, it's marked to stay hot then.
+static bool io_demote(struct pml_io* io) {
+	struct pml* ml = io->pml;
+	if(ml->tier.epfd < 0) {
+		ml->tier.epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(ml->tier.epfd < 0) {
+			return false;
+		}
+	}
+
+	unsigned id;
+	if(ml->tier.n_free) {
+		id = ml->tier.free_slots[--ml->tier.n_free];
+	} else {
+		if(ml->tier.n_slots == ml->tier.cap_slots) {
+			// demoting is optional, so just keep the io hot
+			if(ml->realtime.enabled) {
+				return false;
+			}
+
+			ml->tier.cap_slots = ml->tier.cap_slots ? 2 * ml->tier.cap_slots : 16;
+			ml->tier.slots = realloc(ml->tier.slots,
+				ml->tier.cap_slots * sizeof(*ml->tier.slots));
+			ml->tier.free_slots = realloc(ml->tier.free_slots,
+				ml->tier.cap_slots * sizeof(*ml->tier.free_slots));
+		}
+
+		id = ml->tier.n_slots++;
+		ml->tier.slots[id] = (struct cold_slot) {0};
+	}
+
+	// poll and epoll flags have the same values on linux
+	struct epoll_event ev = {
+		.events = io->events,
+		.data.u64 = ((uint64_t) ml->tier.slots[id].gen << 32) | id,
+	};
+	if(epoll_ctl(ml->tier.epfd, EPOLL_CTL_ADD, io->fd, &ev) != 0) {
+		ml->tier.free_slots[ml->tier.n_free++] = id;
+		io->no_cold = true;
+		return false;
+	}
+
+	ml->tier.slots[id].io = io;
+	io->cold_id = id;
+	unlink_io(io);
+	io->fd_id = UINT_MAX;
+
+	++ml->tier.n_cold;
+	ml->rebuild_fds = true;
+	return true;
+}
+
+// Removes the cold io from the epoll set, without linking it again.
+static void io_release_cold(struct pml_io* io) {
+	struct pml* ml = io->pml;
+	assert(io->cold_id != UINT_MAX);
+	epoll_ctl(ml->tier.epfd, EPOLL_CTL_DEL, io->fd, NULL);
+
+	struct cold_slot* slot = &ml->tier.slots[io->cold_id];
+	slot->io = NULL;
+	++slot->gen;
+	ml->tier.free_slots[ml->tier.n_free++] = io->cold_id;
+	io->cold_id = UINT_MAX;
+
+	--ml->tier.n_cold;
+	ml->rebuild_fds = true;
+}
+
+// Moves the cold io back into the poll set, it will be polled
+// starting with the next iteration.
+static void io_promote(struct pml_io* io) {
+	io_release_cold(io);
+	io->last_active = io->pml->stats.iterations;
+	link_io(io);
+}
+
+// Demotes the io sources that weren't active for tier.cold_after iterations.
+static void demote_idle(struct pml* ml) {
+	uint64_t now = ml->stats.iterations;
+	ml->tier.next_scan = now + (ml->tier.cold_after + 1) / 2;
+	for(struct pml_io* io = ml->io.first; io;) {
+		struct pml_io* next = io->next;
+		if(!io->no_cold && !io->sheddable && io->fd_id != UINT_MAX &&
+				now - io->last_active >= ml->tier.cold_after) {
+			io_demote(io);
+		}
+		io = next;
+	}
+}
+
+// Collects the cold ios that are ready into tier.ready.
+// Since epoll is level-triggered, calling epoll_wait again would only
+// return the same events, so at most one batch is collected per iteration,
+// the rest stays pending in epfd for the next one.
+static void collect_cold(struct pml* ml, struct pollfd* fds, unsigned n_fds) {
+	assert(ml->tier.n_ready == 0 && ml->tier.ready_pos == 0);
+	unsigned id = ml->tier.fd_id;
+	if(!ml->tier.n_cold || id >= n_fds || fds[id].fd != ml->tier.epfd ||
+			!(fds[id].revents & POLLIN)) {
+		return;
+	}
+
+	struct epoll_event evs[128];
+	int n = epoll_wait(ml->tier.epfd, evs, 128, 0);
+	for(int i = 0; i < n; ++i) {
+		uint32_t slot_id = (uint32_t) evs[i].data.u64;
+		uint32_t gen = (uint32_t) (evs[i].data.u64 >> 32);
+		if(slot_id >= ml->tier.n_slots || ml->tier.slots[slot_id].gen != gen) {
+			continue;
+		}
+
+		struct pml_io* io = ml->tier.slots[slot_id].io;
+		if(!io || io->ready_id != UINT_MAX) {
+			continue;
+		}
+
+		ml->tier.ready = grow(ml, ml->tier.ready, &ml->tier.cap_ready,
+			ml->tier.n_ready + 1, sizeof(*ml->tier.ready));
+
+		io->cold_revents = evs[i].events;
+		io->ready_id = ml->tier.n_ready;
+		ml->tier.ready[ml->tier.n_ready++] = io;
+	}
+}
+#endif
+
+static void destroy_timer(struct pml_timer* t) {
+	assert(t);
+	if(t->next) t->next->prev = t->prev;
+	if(t->prev) t->prev->next = t->next;
+	if(t == t->pml->timer.first) t->pml->timer.first = t->next;
+	if(t == t->pml->timer.last) t->pml->timer.last = t->prev;
+	free(t);
+}
+
+static void destroy_defer(struct pml_defer* d) {
+	assert(d);
+	if(d->next) d->next->prev = d->prev;
+	if(d->prev) d->prev->next = d->next;
+	if(d == d->pml->defer.first) d->pml->defer.first = d->next;
+	if(d == d->pml->defer.last) d->pml->defer.last = d->prev;
+	free(d);
+}
+
+static void destroy_custom(struct pml_custom* c) {
+	assert(c);
+	if(c->next) c->next->prev = c->prev;
+	if(c->prev) c->prev->next = c->next;
+	if(c == c->pml->custom.first) c->pml->custom.first = c->next;
+	if(c == c->pml->custom.last) c->pml->custom.last = c->prev;
+	free(c);
+}
+
+// log
+// Formats the message into the log ring. Never blocks.
+static void log_msg(struct pml* ml, const char* fmt, ...) {
+	unsigned head = atomic_load_explicit(&ml->log.head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&ml->log.tail, memory_order_acquire);
+	if(head - tail >= log_ring_size) {
+		atomic_fetch_add_explicit(&ml->log.dropped, 1u, memory_order_relaxed);
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(ml->log.msgs[head % log_ring_size], log_msg_size, fmt, args);
+	va_end(args);
+	atomic_store_explicit(&ml->log.head, head + 1, memory_order_release);
+}
+
+unsigned pml_log_drain(struct pml* ml, pml_log_cb cb, void* data) {
+	assert(ml);
+	assert(cb);
+
+	unsigned tail = atomic_load_explicit(&ml->log.tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&ml->log.head, memory_order_acquire);
+	unsigned count = head - tail;
+	for(; tail != head; ++tail) {
+		cb(ml, ml->log.msgs[tail % log_ring_size], data);
+		atomic_store_explicit(&ml->log.tail, tail + 1, memory_order_release);
+	}
+
+	unsigned dropped = atomic_exchange_explicit(&ml->log.dropped, 0u,
+		memory_order_relaxed);
+	if(dropped) {
+		char msg[log_msg_size];
+		snprintf(msg, sizeof(msg), "pml: %u log messages dropped", dropped);
+		cb(ml, msg, data);
+	}
+
+	return count;
+}
+
+void pml_set_log_cb(struct pml* ml, pml_log_cb cb, void* data) {
+	assert(ml);
+	ml->log.cb = cb;
+	ml->log.data = data;
+}
+
+// mainloop
+struct pml* pml_new(void) {
+	// aligned for pml.published
+	struct pml* ml = aligned_alloc(_Alignof(struct pml), sizeof(*ml));
+	if(ml) {
+		memset(ml, 0, sizeof(*ml));
+#ifdef __linux__
+		ml->tier.epfd = -1;
+		ml->perf.leader = -1;
+#endif
+	}
+	return ml;
+}
+
+void pml_destroy(struct pml* ml) {
+	if(!ml) {
+		return;
+	}
+
+	assert(ml->dispatch_depth == 0 &&
+		"Destroying a mainloop that is still dispatching");
+	if(ml->realtime.enabled) {
+		lock_arrays(ml, false);
+	}
+
+	if(ml->fds) {
+		free(ml->fds);
+	}
+	free(ml->close.fds);
+
+	// free all sources
+	for(struct pml_custom* c = ml->custom.first; c;) {
+		struct pml_custom* n = c->next;
+		free(c);
+		c = n;
+	}
+	for(struct pml_io* c = ml->io.first; c;) {
+		struct pml_io* n = c->next;
+		free(c);
+		c = n;
+	}
+	for(struct pml_io_group* c = ml->io_group.first; c;) {
+		struct pml_io_group* n = c->next;
+		free(c->batch);
+		free(c->events);
+		free(c->spare);
+		free(c);
+		c = n;
+	}
+	for(struct pml_defer* c = ml->defer.first; c;) {
+		struct pml_defer* n = c->next;
+		free(c);
+		c = n;
+	}
+	for(struct pml_timer* c = ml->timer.first; c;) {
+		struct pml_timer* n = c->next;
+		free(c);
+		c = n;
+	}
+	for(struct pml_timer_group* c = ml->timer.group.first; c;) {
+		struct pml_timer_group* n = c->next;
+		free(c->batch);
+		free(c->cb_data);
+		free(c);
+		c = n;
+	}
+
+	for(unsigned i = 0u; i < 2; ++i) {
+		for(struct pml_hook* c = ml->hook[i].first; c;) {
+			struct pml_hook* n = c->next;
+			free(c);
+			c = n;
+		}
+	}
+
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		free(ml->timer.heaps[i].timers);
+		free(ml->timer.heaps[i].deadlines);
+	}
+	free(ml->timer.heaps);
+	free(ml->timer.pending);
+	free(ml->timer.scratch_ids);
+	free(ml->timer.scratch_expired);
+	free(ml->task.heap);
+	free(ml->task.run);
+
+#ifdef __linux__
+	for(struct pml_watch* c = ml->watch.first; c;) {
+		struct pml_watch* n = c->next;
+		free(c);
+		c = n;
+	}
+
+	if(ml->watch.io) {
+		close(ml->watch.fd);
+	}
+	free(ml->watch.buckets);
+	free(ml->watch.buf);
+
+	for(unsigned i = 0u; i < ml->tier.n_slots; ++i) {
+		free(ml->tier.slots[i].io);
+	}
+
+	if(ml->tier.epfd >= 0) {
+		close(ml->tier.epfd);
+	}
+	free(ml->tier.slots);
+	free(ml->tier.free_slots);
+	free(ml->tier.ready);
+#endif
+
+	pml_set_perf(ml, false);
+	free(ml);
+}
+
+// The events to poll for, see pml.lag.
+static unsigned io_poll_events(struct pml_io* io) {
+	return (io->sheddable && io->pml->lag.shedding) ? 0u : io->events;
+}
+
+// The number of callbacks dispatched so far, see pml.lag.
+static uint64_t lag_work(struct pml* ml) {
+	return ml->stats.io_callbacks + ml->stats.timer_callbacks +
+		ml->stats.defer_callbacks + ml->stats.task_callbacks +
+		ml->stats.custom_dispatches;
+}
+
+static void update_lag(struct pml* ml) {
+	if(!ml->lag.high || !ml->lag.sampled) {
+		return;
+	}
+
+	ml->lag.sampled = false;
+	bool shedding = ml->lag.shedding;
+	if(!shedding && ml->lag.sample >= ml->lag.high) {
+		shedding = true;
+	} else if(shedding && ml->lag.sample <= ml->lag.low) {
+		shedding = false;
+	}
+
+	if(shedding == ml->lag.shedding) {
+		return;
+	}
+
+	ml->lag.shedding = shedding;
+	ml->rebuild_fds = true;
+	if(ml->lag.cb) {
+		ml->lag.cb(ml, shedding, ml->lag.data);
+	}
+}
+
+// sampler
+typedef void (*generic_fn)(void);
+
+// What the calling thread is currently dispatching, read by the
+// SIGPROF handler. cb is NULL outside of callbacks.
+// With the default TLS model of shared libraries, the first access from
+// a thread might go through __tls_get_addr, which may allocate and is
+// not async-signal-safe.
+#if defined(__GNUC__) || defined(__clang__)
+	#define TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#else
+	#define TLS_INITIAL_EXEC
+#endif
+
+struct sample_slot {
+	generic_fn cb;
+	void* source;
+	enum pml_sample_type type;
+	unsigned depth;
+};
+
+static _Thread_local struct sample_slot sample_slot TLS_INITIAL_EXEC;
+
+// The entries are claimed by setting the key (the callback) from the
+// signal handler, therefore all atomic.
+struct sampler_entry {
+	atomic_uintptr_t key;
+	atomic_int type;
+	atomic_uintptr_t source;
+	_Atomic uint64_t samples;
+	_Atomic uint64_t nested;
+};
+
+static struct {
+	bool running;
+	struct sigaction old_action;
+	struct itimerval old_timer;
+	_Atomic uint64_t samples;
+	_Atomic uint64_t idle;
+	_Atomic uint64_t dropped;
+	struct sampler_entry table[sampler_table_size];
+} sampler;
+
+// Publishes the callback that is about to be called, returns the
+// previous slot that must be restored with sample_leave afterwards.
+// The samples are statistical anyways, so a sample taken in the middle
+// of the update might be slightly inconsistent.
+static inline struct sample_slot sample_enter(enum pml_sample_type type,
+		void* source, generic_fn cb, unsigned depth) {
+	struct sample_slot prev = sample_slot;
+	sample_slot = (struct sample_slot) {cb, source, type, depth};
+	atomic_signal_fence(memory_order_release);
+	return prev;
+}
+
+static inline void sample_leave(struct sample_slot prev) {
+	atomic_signal_fence(memory_order_release);
+	sample_slot = prev;
+}
+
+static void run_hooks(struct pml* ml, enum pml_hook_type type) {
+	// hook_next allows hooks to destroy other hooks
+	for(struct pml_hook* h = ml->hook[type].first; h; h = ml->hook_next) {
+		ml->hook_next = h->next;
+		struct sample_slot slot = sample_enter(pml_sample_hook, h,
+			(generic_fn) h->cb, ml->dispatch_depth);
+		h->cb(h);
+		sample_leave(slot);
+	}
+}
+
+static void sampler_handler(int sig) {
+	(void) sig;
+	atomic_signal_fence(memory_order_acquire);
+	struct sample_slot slot = sample_slot;
+
+	atomic_fetch_add_explicit(&sampler.samples, 1u, memory_order_relaxed);
+	if(!slot.cb) {
+		atomic_fetch_add_explicit(&sampler.idle, 1u, memory_order_relaxed);
+		return;
+	}
+
+	// open addressing with linear probing, entries are never removed
+	uintptr_t key = (uintptr_t) slot.cb;
+	unsigned id = (unsigned) ((key >> 4) * 2654435761u) % sampler_table_size;
+	for(unsigned i = 0u; i < sampler_table_size; ++i) {
+		struct sampler_entry* e = &sampler.table[id];
+		uintptr_t cur = atomic_load_explicit(&e->key, memory_order_acquire);
+		if(!cur) {
+			uintptr_t expected = 0u;
+			if(atomic_compare_exchange_strong(&e->key, &expected, key)) {
+				cur = key;
+				atomic_store_explicit(&e->type, (int) slot.type,
+					memory_order_relaxed);
+			} else {
+				cur = expected;
+			}
+		}
+
+		if(cur == key) {
+			atomic_store_explicit(&e->source, (uintptr_t) slot.source,
+				memory_order_relaxed);
+			atomic_fetch_add_explicit(&e->samples, 1u, memory_order_relaxed);
+			if(slot.depth > 1) {
+				atomic_fetch_add_explicit(&e->nested, 1u, memory_order_relaxed);
+			}
+			return;
+		}
+
+		id = (id + 1) % sampler_table_size;
+	}
+
+	atomic_fetch_add_explicit(&sampler.dropped, 1u, memory_order_relaxed);
+}
+
+int pml_sampler_start(unsigned hz) {
+	if(sampler.running) {
+		return -EBUSY;
+	}
+
+	atomic_store(&sampler.samples, 0u);
+	atomic_store(&sampler.idle, 0u);
+	atomic_store(&sampler.dropped, 0u);
+	for(unsigned i = 0u; i < sampler_table_size; ++i) {
+		struct sampler_entry* e = &sampler.table[i];
+		atomic_store(&e->key, 0u);
+		atomic_store(&e->samples, 0u);
+		atomic_store(&e->nested, 0u);
+	}
+
+	struct sigaction action = {0};
+	action.sa_handler = sampler_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if(sigaction(SIGPROF, &action, &sampler.old_action) != 0) {
+		return -errno;
+	}
+
+	hz = hz ? hz : 100u;
+	long usec = 1000 * 1000 / (long) hz;
+	struct itimerval timer = {0};
+	timer.it_interval.tv_usec = usec ? usec : 1;
+	timer.it_value = timer.it_interval;
+	if(setitimer(ITIMER_PROF, &timer, &sampler.old_timer) != 0) {
+		int err = errno;
+		sigaction(SIGPROF, &sampler.old_action, NULL);
+		return -err;
+	}
+
+	sampler.running = true;
+	return 0;
+}
+
+void pml_sampler_stop(void) {
+	if(!sampler.running) {
+		return;
+	}
+
+	setitimer(ITIMER_PROF, &sampler.old_timer, NULL);
+	sigaction(SIGPROF, &sampler.old_action, NULL);
+	sampler.running = false;
+}
+
+static int compare_samples(const void* a, const void* b) {
+	uint64_t sa = ((const struct pml_sample*) a)->samples;
+	uint64_t sb = ((const struct pml_sample*) b)->samples;
+	return (sa < sb) - (sa > sb);
+}
+
+unsigned pml_sampler_report(struct pml_sample* samples, unsigned n,
+		struct pml_sampler_stats* stats) {
+	assert(samples || !n);
+	if(stats) {
+		stats->samples = atomic_load(&sampler.samples);
+		stats->idle = atomic_load(&sampler.idle);
+		stats->dropped = atomic_load(&sampler.dropped);
+	}
+
+	struct pml_sample all[sampler_table_size];
+	unsigned count = 0u;
+	for(unsigned i = 0u; i < sampler_table_size; ++i) {
+		struct sampler_entry* e = &sampler.table[i];
+		uintptr_t key = atomic_load(&e->key);
+		uint64_t n_samples = atomic_load(&e->samples);
+		if(!key || !n_samples) {
+			continue;
+		}
+
+		struct pml_sample* s = &all[count++];
+		s->type = (enum pml_sample_type) atomic_load(&e->type);
+		s->cb = (generic_fn) key;
+		s->source = (void*) atomic_load(&e->source);
+		s->samples = n_samples;
+		s->nested = atomic_load(&e->nested);
+	}
+
+	qsort(all, count, sizeof(*all), compare_samples);
+	count = min(count, n);
+	memcpy(samples, all, count * sizeof(*all));
+	return count;
+}
+
+// perf
+#ifdef __linux__
+static bool perf_read(struct pml* ml, uint64_t values[perf_n_events]) {
+	uint64_t buf[1 + perf_n_events];
+	ssize_t size = (ssize_t) ((1 + ml->perf.n_events) * sizeof(*buf));
+	if(read(ml->perf.leader, buf, (size_t) size) != size) {
+		return false;
+	}
+
+	for(unsigned i = 0u; i < perf_n_events; ++i) {
+		unsigned id = ml->perf.read_id[i];
+		values[i] = id == UINT_MAX ? 0u : buf[1 + id];
+	}
+	return true;
+}
+
+static void perf_add(struct pml_perf_counters* c,
+		const uint64_t from[perf_n_events], const uint64_t to[perf_n_events]) {
+	++c->calls;
+	c->cycles += to[perf_cycles] - from[perf_cycles];
+	c->instructions += to[perf_instructions] - from[perf_instructions];
+	c->cache_misses += to[perf_cache_misses] - from[perf_cache_misses];
+	c->branch_misses += to[perf_branch_misses] - from[perf_branch_misses];
+}
+
+// Returns whether the counters were read and the phase must be ended
+// with perf_end.
+static bool perf_begin(struct pml* ml, uint64_t start[perf_n_events]) {
+	return ml->perf.leader >= 0 && ml->dispatch_depth == 0 &&
+		perf_read(ml, start);
+}
+
+static void perf_end(struct pml* ml, enum pml_perf_phase phase,
+		const uint64_t start[perf_n_events]) {
+	uint64_t end[perf_n_events];
+	if(perf_read(ml, end)) {
+		perf_add(&ml->perf.counters[phase], start, end);
+	}
+}
+
+// Attributes the counters since the last switch to the current dispatch
+// phase and starts the given one (-1 for none).
+static void perf_switch(struct pml* ml, int phase) {
+	if(ml->perf.leader < 0 || ml->dispatch_depth != 1) {
+		return;
+	}
+
+	uint64_t now[perf_n_events];
+	if(!perf_read(ml, now)) {
+		return;
+	}
+
+	if(ml->perf.phase >= 0) {
+		perf_add(&ml->perf.counters[ml->perf.phase], ml->perf.last, now);
+	}
+
+	memcpy(ml->perf.last, now, sizeof(now));
+	ml->perf.phase = phase;
+}
+#else
+static bool perf_begin(struct pml* ml, uint64_t* start) {
+	(void) ml;
+	(void) start;
+	return false;
+}
+static void perf_end(struct pml* ml, enum pml_perf_phase phase,
+		const uint64_t* start) {
+	(void) ml;
+	(void) phase;
+	(void) start;
+}
+static void perf_switch(struct pml* ml, int phase) {
+	(void) ml;
+	(void) phase;
+}
+#endif
+
+int pml_set_perf(struct pml* ml, bool enable) {
+	assert(ml);
+#ifdef __linux__
+	if(ml->perf.leader >= 0) {
+		for(unsigned i = 0u; i < perf_n_events; ++i) {
+			if(ml->perf.fds[i] >= 0) {
+				close(ml->perf.fds[i]);
+			}
+		}
+		ml->perf.leader = -1;
+	}
+
+	if(!enable) {
+		return 0;
+	}
+
+	static const uint64_t configs[perf_n_events] = {
+		[perf_cycles] = PERF_COUNT_HW_CPU_CYCLES,
+		[perf_instructions] = PERF_COUNT_HW_INSTRUCTIONS,
+		[perf_cache_misses] = PERF_COUNT_HW_CACHE_MISSES,
+		[perf_branch_misses] = PERF_COUNT_HW_BRANCH_MISSES,
+	};
+
+	// events that aren't supported by the hardware are just left out,
+	// their counters stay 0
+	int err = 0;
+	ml->perf.n_events = 0u;
+	for(unsigned i = 0u; i < perf_n_events; ++i) {
+		struct perf_event_attr attr = {0};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		// the calling thread on any cpu
+		int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1,
+			ml->perf.leader, PERF_FLAG_FD_CLOEXEC);
+		ml->perf.fds[i] = fd;
+		ml->perf.read_id[i] = UINT_MAX;
+		if(fd < 0) {
+			err = errno;
+			continue;
+		}
+
+		if(ml->perf.leader < 0) {
+			ml->perf.leader = fd;
+		}
+		ml->perf.read_id[i] = ml->perf.n_events++;
+	}
+
+	if(ml->perf.leader < 0) {
+		return -err;
+	}
+
+	ml->perf.phase = -1;
+	memset(ml->perf.counters, 0, sizeof(ml->perf.counters));
+	return 0;
+#else
+	return enable ? -ENOSYS : 0;
+#endif
+}
+
+void pml_get_perf(struct pml* ml,
+		struct pml_perf_counters counters[pml_perf_phase_count]) {
+	assert(ml);
+	assert(counters);
+#ifdef __linux__
+	memcpy(counters, ml->perf.counters, sizeof(ml->perf.counters));
+#else
+	memset(counters, 0, pml_perf_phase_count * sizeof(*counters));
+#endif
+}
+
+void pml_prepare(struct pml* ml) {
+	assert(ml);
+	assert((ml->state == state_none || is_dispatch_state(ml->state)) &&
+		"Invalid state of mainloop for pml_prepare");
+
+	// dispatching isn't finished yet, just continue it
+	// pml_poll will detect that as well, but we set the timeout
+	// to zero so we can return it from pml_query
+	if(ml->state != state_none) {
+		ml->prepared_timeout = 0;
+		return;
+	}
+
+	if(ml->realtime.enabled) {
+		ml->realtime.prepare_start = now_ns();
+	}
+
+	uint64_t perf_start[perf_n_events];
+	bool perf = perf_begin(ml, perf_start);
+
+	ml->state = state_preparing;
+	run_hooks(ml, pml_hook_prepare);
+	update_lag(ml);
+
+	// re-arm the probe when the mainloop got busy again
+	if(ml->lag.high && !ml->lag.probe.enabled &&
+			lag_work(ml) != ml->lag.work) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timer_set(&ml->lag.probe, timespec_ns(&now) + ml->lag.high);
+		ml->lag.work = lag_work(ml);
+	}
+
+	ml->prepared_timeout = -1;
+	if(ml->n_enabled_defered || ml->task.n_heap) {
+		ml->prepared_timeout = 0;
+	}
+
+#ifdef __linux__
+	if(ml->tier.cold_after && ml->stats.iterations >= ml->tier.next_scan) {
+		demote_idle(ml);
+	}
+
+	// all cold io sources share the pollfd of the epoll fd
+	unsigned n_fds = ml->n_io - ml->tier.n_cold + (ml->tier.n_cold ? 1 : 0);
+#else
+	unsigned n_fds = ml->n_io;
+#endif
+
+	// prepare custom sources
+	for(struct pml_custom* c = ml->custom.first; c; c = c->next) {
+		if(c->impl->prepare) {
+			c->impl->prepare(c);
+		}
+
+		unsigned count = 0;
+		struct pollfd* fds = NULL;
+		if(!ml->rebuild_fds && n_fds < ml->n_fds) {
+			fds = &ml->fds[n_fds];
+			count = ml->n_fds - n_fds;
+		}
+
+		int timeout;
+		count = c->impl->query(c, fds, count, &timeout);
+		assert(timeout >= -1);
+
+		if(timeout != -1 && (ml->prepared_timeout == -1 ||
+				timeout < ml->prepared_timeout)) {
+			ml->prepared_timeout = timeout;
+		}
+
+		c->n_fds_last = count;
+		n_fds += count;
+	}
+
+	// timers: only the next timer of every clock is relevant
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		struct pml_timer* next = heap_fixup_root(h);
+		if(!next) {
+			continue;
+		}
+
+		// timers of a clock that can't be read never expire, see
+		// collect_timers
+		struct timespec now;
+		if(clock_gettime(h->clock, &now) != 0) {
+			continue;
+		}
+
+		// poll only takes an int timeout. When a deadline is further away,
+		// we wake up early and just prepare again
+		int64_t ms = sub_ns(next->time, timespec_ns(&now)) / (1000 * 1000);
+		if(ms > INT_MAX) {
+			ms = INT_MAX;
+		}
+
+		if(ms < 0) {
+			ml->prepared_timeout = 0;
+		} else if(ml->prepared_timeout == -1 || ms < ml->prepared_timeout) {
+			ml->prepared_timeout = ms;
+		}
+	}
+
+	// rebuild fds if needed
+	if(ml->rebuild_fds || n_fds > ml->n_fds) {
+		ml->rebuild_fds = false;
+		++ml->stats.fds_rebuilds;
+		if(n_fds > ml->cap_fds) {
+			++ml->stats.fds_reallocs;
+			ml->fds = grow(ml, ml->fds, &ml->cap_fds, n_fds, sizeof(*ml->fds));
+		}
+		ml->n_fds = n_fds;
+
+		unsigned i = 0u;
+		for(struct pml_io* io = ml->io.first; io; io = io->next) {
+			ml->fds[i].fd = io->fd;
+			ml->fds[i].events = io_poll_events(io);
+			io->fd_id = i;
+			++i;
+		}
+
+#ifdef __linux__
+		ml->tier.fd_id = UINT_MAX;
+		if(ml->tier.n_cold) {
+			ml->fds[i].fd = ml->tier.epfd;
+			ml->fds[i].events = POLLIN;
+			ml->tier.fd_id = i;
+			++i;
+		}
+#endif
+
+		for(struct pml_custom* c = ml->custom.first; c; c = c->next) {
+			int timeout;
+			unsigned count = c->impl->query(c, &ml->fds[i], c->n_fds_last, &timeout);
+			assert(count == c->n_fds_last &&
+				"Custom event source changed number of fds without prepare");
+
+			c->fds_id = i;
+			i += count;
+		}
+
+		assert(i == ml->n_fds);
+	}
+
+	assert(ml->state == state_preparing);
+	ml->state = state_prepared;
+	if(ml->realtime.enabled) {
+		ml->realtime.iteration_ns = now_ns() - ml->realtime.prepare_start;
+	}
+	if(perf) {
+		perf_end(ml, pml_perf_prepare, perf_start);
+	}
+	return;
+}
+
+// Spins with non-blocking polls for up to the busy poll budget and only
+// then falls back to a blocking poll with the remaining timeout.
+// Spinning is skipped when the average time between polls that
+// returned events is much larger than the budget.
+static int busy_poll(struct pml* ml, int timeout) {
+	int64_t start = now_ns();
+	int64_t budget = ml->busy_poll.budget;
+	if(timeout > 0 && 1000 * 1000 * (int64_t) timeout < budget) {
+		budget = 1000 * 1000 * (int64_t) timeout;
+	}
+
+	int ret = 0;
+	int64_t now = start;
+	bool spin = ml->busy_poll.interval < 2 * ml->busy_poll.budget;
+	if(spin) {
+		do {
+			ret = poll(ml->fds, ml->n_fds, 0);
+			now = now_ns();
+			// an interrupted poll just had no events, when the budget
+			// runs out we still have to block
+			if(ret < 0 && errno == EINTR) {
+				ret = 0;
+			}
+		} while(ret == 0 && now - start < budget);
+	} else {
+		++ml->busy_poll.stats.skipped;
+	}
+
+	if(ret > 0) {
+		++ml->busy_poll.stats.spins;
+	} else if(ret == 0) {
+		if(spin) {
+			// the time since the last arrival is a lower bound for the
+			// current inter-arrival time, learn from it so we stop
+			// spinning when events get rare
+			++ml->busy_poll.stats.blocks;
+			int64_t since = now - ml->busy_poll.last_arrival;
+			ml->busy_poll.interval += (since - ml->busy_poll.interval) / 8;
+		}
+
+		if(timeout > 0) {
+			int64_t spent = (now - start) / (1000 * 1000);
+			timeout = spent >= timeout ? 0 : timeout - (int) spent;
+		}
+
+		do {
+			ret = poll(ml->fds, ml->n_fds, timeout);
+		} while(ret < 0 && errno == EINTR);
+		now = now_ns();
+	}
+
+	if(ret > 0) {
+		// exponential moving average of the inter-arrival times
+		int64_t interval = now - ml->busy_poll.last_arrival;
+		ml->busy_poll.interval += (interval - ml->busy_poll.interval) / 8;
+		ml->busy_poll.last_arrival = now;
+	}
+
+	return ret;
+}
+
+int pml_poll(struct pml* ml, int timeout) {
+	assert(ml);
+	assert((ml->state == state_prepared || is_dispatch_state(ml->state)) &&
+		"Invalid mainloop state for calling pml_poll");
+
+	// dispatching not finished yet, we can skip polling.
+	if(ml->state != state_prepared) {
+		return 0;
+	}
+
+	uint64_t perf_start[perf_n_events];
+	bool perf = perf_begin(ml, perf_start);
+
+	int ret;
+	if(ml->busy_poll.budget && timeout != 0) {
+		ret = busy_poll(ml, timeout);
+	} else {
+		// we ignore incoming signals
+		do {
+			ret = poll(ml->fds, ml->n_fds, timeout);
+		} while(ret < 0 && errno == EINTR);
+	}
+
+	if(ret < 0) {
+		int err = errno;
+		log_msg(ml, "pml_poll: %s (%d)", strerror(err), err);
+	}
+
+	++ml->stats.polls;
+	if(ret > 0) {
+		ml->stats.poll_ready += (unsigned) ret;
+	}
+
+	ml->state = state_polled;
+	run_hooks(ml, pml_hook_check);
+	if(perf) {
+		perf_end(ml, pml_perf_poll, perf_start);
+	}
+	return ret;
+}
+
+static bool task_less(const struct task* a, const struct task* b) {
+	return a->deadline < b->deadline ||
+		(a->deadline == b->deadline && a->seq < b->seq);
+}
+
+// Removes the root of the task heap and moves it into run.
+static void task_pop(struct pml* ml) {
+	struct task* heap = ml->task.heap;
+	ml->task.run[ml->task.n_run++] = heap[0];
+
+	struct task t = heap[--ml->task.n_heap];
+	unsigned n = ml->task.n_heap;
+	unsigned i = 0u;
+	while(true) {
+		unsigned child = 2 * i + 1;
+		if(child >= n) {
+			break;
+		}
+
+		if(child + 1 < n && task_less(&heap[child + 1], &heap[child])) {
+			++child;
+		}
+
+		if(!task_less(&heap[child], &t)) {
+			break;
+		}
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = t;
+}
+
+static bool dispatch_task(struct pml* ml) {
+	// Like dispatch_timer, the run array and position are used to
+	// continue dispatching instead of state_data.
+	if(ml->state != state_dispatch_task) {
+		assert(ml->task.n_run == 0 && ml->task.run_pos == 0);
+		ml->task.run = grow(ml, ml->task.run, &ml->task.cap_run,
+			ml->task.n_heap, sizeof(*ml->task.run));
+
+		while(ml->task.n_heap) {
+			task_pop(ml);
+		}
+	}
+
+	ml->state = state_dispatch_task;
+	while(ml->task.run_pos < ml->task.n_run) {
+		struct task* t = &ml->task.run[ml->task.run_pos++];
+		++ml->stats.task_callbacks;
+		struct sample_slot slot = sample_enter(pml_sample_task, t->arg,
+			(generic_fn) t->fn, ml->dispatch_depth);
+		t->fn(t->arg);
+		sample_leave(slot);
+	}
+
+	ml->task.n_run = 0u;
+	ml->task.run_pos = 0u;
+
+	assert((ml->state == state_dispatch_task || ml->state == state_none) &&
+		"Inconsistent state change");
+	return ml->state == state_dispatch_task;
+}
+
+static bool dispatch_defer(struct pml* ml) {
 	// If we are continuing defer dispatching, the source to dispatch
 	// is stored in state_data. Otherwise we start with the first one.
 	struct pml_defer* d = ml->defer.first;
@@ -428,7 +2151,11 @@ static bool dispatch_defer(struct pml* ml) {
 		ml->state_data = d->next;
 		if(d->enabled) {
 			assert(d->cb);
+			++ml->stats.defer_callbacks;
+			struct sample_slot slot = sample_enter(pml_sample_defer, d,
+				(generic_fn) d->cb, ml->dispatch_depth);
 			d->cb(d);
+			sample_leave(slot);
 		}
 	}
 
@@ -439,49 +2166,358 @@ static bool dispatch_defer(struct pml* ml) {
 	return ml->state == state_dispatch_defer;
 }
 
-static bool dispatch_timer(struct pml* ml) {
-	struct pml_timer* t = ml->timer.first;
-	if(ml->state == state_dispatch_timer) {
-		t = ml->state_data;
+static void pending_push(struct pml* ml, struct pml_timer* t) {
+	ml->timer.pending = grow(ml, ml->timer.pending, &ml->timer.cap_pending,
+		ml->timer.n_pending + 1, sizeof(*ml->timer.pending));
+
+	t->pending = true;
+	t->queue_id = ml->timer.n_pending;
+	ml->timer.pending[ml->timer.n_pending++] = t;
+}
+
+// Moves the expired timer into the pending array or the batch of its group.
+static void collect_timer(struct pml* ml, struct pml_timer* t) {
+	struct pml_timer_group* g = t->group;
+	if(!g) {
+		pending_push(ml, t);
+		return;
 	}
 
-	struct timespec now;
-	clockid_t clk = CLOCK_REALTIME;
-	clock_gettime(clk, &now);
+	g->batch = grow(ml, g->batch, &g->cap_batch, g->n_batch + 1,
+		sizeof(*g->batch));
+	t->pending = true;
+	t->queue_id = g->n_batch;
+	g->batch[g->n_batch++] = t;
+	if(!g->entry.pending) {
+		pending_push(ml, &g->entry);
+	}
+}
 
-	ml->state = state_dispatch_timer;
-	for(; t; t = ml->state_data) {
-		ml->state_data = t->next;
-		if(!t->enabled) {
+static int expired_cmp(const void* a, const void* b) {
+	const struct expired_timer* ea = a;
+	const struct expired_timer* eb = b;
+	return (ea->late < eb->late) - (ea->late > eb->late);
+}
+
+// collect_timers for flat storage: finds all expired timers with one
+// scan per clock and then sorts them by lateness.
+static void collect_timers_flat(struct pml* ml) {
+	unsigned n = 0u;
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		if(!h->size || !h->now_valid) {
+			continue;
+		}
+
+		ml->timer.scratch_ids = grow(ml, ml->timer.scratch_ids,
+			&ml->timer.cap_scratch_ids, h->size, sizeof(*ml->timer.scratch_ids));
+
+		// consistent with prepare: expired if the timeout would be 0ms
+		int64_t now = h->now;
+		int64_t limit = now + timer_slack_ns - 1;
+		unsigned count = deadline_expired(h->deadlines, h->size, limit,
+			ml->timer.scratch_ids);
+		ml->timer.scratch_expired = grow(ml, ml->timer.scratch_expired,
+			&ml->timer.cap_scratch_expired, n + count,
+			sizeof(*ml->timer.scratch_expired));
+
+		for(unsigned j = 0u; j < count; ++j) {
+			unsigned id = ml->timer.scratch_ids[j];
+			ml->timer.scratch_expired[n++] = (struct expired_timer) {
+				.timer = h->timers[id],
+				.heap = h,
+				.late = sub_ns(now, h->deadlines[id]),
+			};
+		}
+	}
+
+	struct expired_timer* expired = ml->timer.scratch_expired;
+	if(n > 1) {
+		sort(expired, n, sizeof(*expired), expired_cmp);
+	}
+
+	if(n && (!ml->lag.sampled || expired[0].late > ml->lag.sample)) {
+		ml->lag.sampled = true;
+		ml->lag.sample = expired[0].late;
+	}
+
+	// members of groups count individually, see collect_timers
+	unsigned limit = ml->timer.dispatch_limit;
+	for(unsigned i = 0u; i < n && (!limit || i < limit); ++i) {
+		struct pml_timer* t = expired[i].timer;
+		heap_remove(expired[i].heap, t->queue_id);
+		collect_timer(ml, t);
+	}
+}
+
+// Moves the expired timers from the heaps into the pending array,
+// most overdue first. Stops after timer.dispatch_limit timers, if set.
+// Grouped timers count individually, even though the group is only
+// dispatched once; the remaining ones stay in the heaps for the next
+// iteration.
+static void collect_timers(struct pml* ml) {
+	assert(ml->timer.n_pending == 0 && ml->timer.pending_pos == 0);
+
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		struct timespec now;
+		h->now_valid = (clock_gettime(h->clock, &now) == 0);
+		if(!h->now_valid) {
+			int err = errno;
+			if(h->size) {
+				log_msg(ml, "clock_gettime: %s (%d)", strerror(err), err);
+			}
 			continue;
 		}
 
-		if(t->clock != clk) {
-			clk = t->clock;
-			clock_gettime(clk, &now);
+		h->now = timespec_ns(&now);
+	}
+
+	if(ml->timer.flat) {
+		collect_timers_flat(ml);
+		return;
+	}
+
+	unsigned limit = ml->timer.dispatch_limit;
+	for(unsigned collected = 0u; !limit || collected < limit; ++collected) {
+		// find the expired timer with the greatest lateness over all clocks
+		struct timer_heap* next = NULL;
+		int64_t max_late = 0;
+		for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+			struct timer_heap* h = &ml->timer.heaps[i];
+			if(!h->now_valid) {
+				continue;
+			}
+
+			struct pml_timer* root = heap_fixup_root(h);
+			if(!root) {
+				continue;
+			}
+
+			// consistent with prepare: if the timer would have resulted in a
+			// timeout of 0ms, it's expired
+			int64_t late = sub_ns(h->now, root->time);
+			if(late <= -timer_slack_ns) {
+				continue;
+			}
+
+			if(!next || late > max_late) {
+				next = h;
+				max_late = late;
+			}
+		}
+
+		if(!next) {
+			break;
+		}
+
+		if(!ml->lag.sampled || max_late > ml->lag.sample) {
+			ml->lag.sampled = true;
+			ml->lag.sample = max_late;
 		}
 
-		struct timespec diff = t->time;
-		timespec_subtract(&diff, &now);
-		if(timespec_ms(&diff) <= 0) {
-			assert(t->cb);
-			t->enabled = false;
-			t->cb(t);
+		struct pml_timer* t = next->timers[0];
+		heap_remove(next, 0);
+		collect_timer(ml, t);
+	}
+}
+
+static bool dispatch_timer(struct pml* ml) {
+	// When not continuing a previous dispatch, collect the expired
+	// timers. Instead of state_data, the pending array and position
+	// are used to continue dispatching.
+	if(ml->state != state_dispatch_timer) {
+		collect_timers(ml);
+	}
+
+	ml->state = state_dispatch_timer;
+	while(ml->timer.pending_pos < ml->timer.n_pending) {
+		struct pml_timer* t = ml->timer.pending[ml->timer.pending_pos++];
+		if(!t) {
+			continue;
 		}
+
+		assert(t->cb);
+		t->pending = false;
+		t->queue_id = UINT_MAX;
+		t->enabled = false;
+		++ml->stats.timer_callbacks;
+		struct sample_slot slot = sample_enter(pml_sample_timer, t,
+			(generic_fn) t->cb, ml->dispatch_depth);
+		t->cb(t);
+		sample_leave(slot);
 	}
 
+	ml->timer.n_pending = 0u;
+	ml->timer.pending_pos = 0u;
+
 	assert((ml->state == state_dispatch_timer || ml->state == state_none) &&
 		"Inconsistent state change");
 	return ml->state == state_dispatch_timer;
 }
 
+// Calls the callback of the ready io or batches the event in its group.
+static void io_ready(struct pml* ml, struct pml_io* io, unsigned revents) {
+	struct pml_io_group* g = io->group;
+	if(!g) {
+		++ml->stats.io_callbacks;
+		struct sample_slot slot = sample_enter(pml_sample_io, io,
+			(generic_fn) io->cb, ml->dispatch_depth);
+		io->cb(io, revents);
+		sample_leave(slot);
+		return;
+	}
+
+	if(io->batch_id != UINT_MAX) {
+		io->group_revents |= revents;
+		return;
+	}
+
+	g->batch = grow(ml, g->batch, &g->cap_batch, g->n_batch + 1,
+		sizeof(*g->batch));
+	io->batch_id = g->n_batch;
+	io->group_revents = revents;
+	g->batch[g->n_batch++] = io;
+	if(!g->queued) {
+		g->queued = true;
+		g->ready_next = NULL;
+		if(ml->io_group.ready_last) {
+			ml->io_group.ready_last->ready_next = g;
+		} else {
+			ml->io_group.ready_first = g;
+		}
+		ml->io_group.ready_last = g;
+	}
+}
+
+static void free_io_group(struct pml_io_group* g) {
+	struct pml* ml = g->pml;
+	if(g->next) g->next->prev = g->prev;
+	if(g->prev) g->prev->next = g->next;
+	if(g == ml->io_group.first) ml->io_group.first = g->next;
+	if(g == ml->io_group.last) ml->io_group.last = g->prev;
+	free(g->batch);
+	free(g->events);
+	free(g->spare);
+	free(g);
+}
+
+// Calls the queued io groups. The group is popped from the queue before
+// its callback is called.
+static void dispatch_io_groups(struct pml* ml) {
+	struct pml_io_group* g;
+	while((g = ml->io_group.ready_first)) {
+		ml->io_group.ready_first = g->ready_next;
+		if(!ml->io_group.ready_first) {
+			ml->io_group.ready_last = NULL;
+		}
+		g->queued = false;
+
+		// nested dispatch of the group while its callback is running
+		if(!g->events) {
+			g->events = g->spare;
+			g->spare = NULL;
+		}
+
+		if(!g->events) {
+			unsigned cap = 0u;
+			g->events = grow(ml, NULL, &cap, g->cap_events, sizeof(*g->events));
+		}
+
+		g->events = grow(ml, g->events, &g->cap_events, g->n_batch,
+			sizeof(*g->events));
+
+		struct pml_io_event* events = g->events;
+		unsigned cap = g->cap_events;
+		unsigned count = 0u;
+		for(unsigned i = 0u; i < g->n_batch; ++i) {
+			struct pml_io* io = g->batch[i];
+			if(!io) {
+				continue;
+			}
+
+			io->batch_id = UINT_MAX;
+			events[count++] = (struct pml_io_event) {
+				.data = io->data,
+				.revents = io->group_revents,
+			};
+		}
+
+		g->n_batch = 0u;
+		if(!count) {
+			continue;
+		}
+
+		g->events = NULL;
+		++g->running;
+		++ml->stats.io_callbacks;
+		struct sample_slot slot = sample_enter(pml_sample_io_group, g,
+			(generic_fn) g->cb, ml->dispatch_depth);
+		g->cb(g, events, count);
+		sample_leave(slot);
+		--g->running;
+
+		if(g->destroyed) {
+			free(events);
+			if(!g->running) {
+				free_io_group(g);
+			}
+		} else if(cap < g->cap_events) {
+			free(events);
+		} else if(!g->events) {
+			g->events = events;
+		} else if(!g->spare) {
+			g->spare = events;
+		} else {
+			free(events);
+		}
+	}
+}
+
 static bool dispatch_io(struct pml* ml, struct pollfd* fds, unsigned n_fds) {
 	struct pml_io* io = ml->io.first;
 	if(ml->state == state_dispatch_io) {
 		io = ml->state_data;
 	}
+#ifdef __linux__
+	else {
+		collect_cold(ml, fds, n_fds);
+	}
+#endif
 
 	ml->state = state_dispatch_io;
+
+#ifdef __linux__
+	// Ready cold sources first. They are promoted before their callback
+	// is called. state_data already holds the first hot source, so that
+	// nested dispatching continues with the hot ones afterwards.
+	ml->state_data = io;
+	while(ml->tier.ready_pos < ml->tier.n_ready) {
+		struct pml_io* c = ml->tier.ready[ml->tier.ready_pos++];
+		if(!c) {
+			continue;
+		}
+
+		c->ready_id = UINT_MAX;
+		unsigned events = (c->events | POLLERR | POLLHUP | POLLNVAL);
+		unsigned revents = c->cold_revents & events;
+		if(!revents) {
+			continue;
+		}
+
+		if(c->cold_id != UINT_MAX) {
+			io_promote(c);
+		}
+
+		c->last_active = ml->stats.iterations;
+		io_ready(ml, c, revents);
+	}
+
+	ml->tier.n_ready = 0u;
+	ml->tier.ready_pos = 0u;
+	io = ml->state_data;
+#endif
+
 	for(; io; io = ml->state_data) {
 		ml->state_data = io->next;
 
@@ -500,10 +2536,17 @@ static bool dispatch_io(struct pml* ml, struct pollfd* fds, unsigned n_fds) {
 		unsigned events = (io->events | POLLERR | POLLHUP | POLLNVAL);
 		unsigned revents = fd->revents & events;
 		if(revents) {
-			io->cb(io, revents);
+#ifdef __linux__
+			io->last_active = ml->stats.iterations;
+#endif
+			io_ready(ml, io, revents);
 		}
 	}
 
+	if(ml->state == state_dispatch_io) {
+		dispatch_io_groups(ml);
+	}
+
 	assert((ml->state == state_dispatch_io || ml->state == state_none) &&
 		"Inconsistent state change");
 	return ml->state == state_dispatch_io;
@@ -530,7 +2573,15 @@ static bool dispatch_custom(struct pml* ml, struct pollfd* fds,
 		assert(c->fds_id + c->n_fds_last <= n_fds
 			&& "Not enough fds passed to pml_dispatch");
 		struct pollfd* fd = &fds[c->fds_id];
+		if(c->impl->check && !c->impl->check(c, fd, c->n_fds_last)) {
+			continue;
+		}
+
+		++ml->stats.custom_dispatches;
+		struct sample_slot slot = sample_enter(pml_sample_custom, c,
+			(generic_fn) c->impl->dispatch, ml->dispatch_depth);
 		c->impl->dispatch(c, fd, c->n_fds_last);
+		sample_leave(slot);
 	}
 
 	assert((ml->state == state_dispatch_custom || ml->state == state_none) &&
@@ -538,24 +2589,101 @@ static bool dispatch_custom(struct pml* ml, struct pollfd* fds,
 	return ml->state == state_dispatch_custom;
 }
 
+// Seqlock writer side, see pml.published.
+static void publish_stats(struct pml* ml) {
+	uint64_t values[sizeof(ml->stats) / sizeof(uint64_t)];
+	memcpy(values, &ml->stats, sizeof(values));
+
+	unsigned seq = atomic_load_explicit(&ml->published.seq, memory_order_relaxed);
+	atomic_store_explicit(&ml->published.seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for(unsigned i = 0u; i < sizeof(values) / sizeof(values[0]); ++i) {
+		atomic_store_explicit(&ml->published.values[i], values[i],
+			memory_order_relaxed);
+	}
+	atomic_store_explicit(&ml->published.seq, seq + 2, memory_order_release);
+}
+
+static int compare_fd(const void* a, const void* b) {
+	int fa = *(const int*) a;
+	int fb = *(const int*) b;
+	return (fa > fb) - (fa < fb);
+}
+
+// Closes [first, last] with as few syscalls as possible.
+static void close_fds(struct pml* ml, int first, int last) {
+#if defined(__linux__) && defined(SYS_close_range)
+	if(!ml->close.no_range && last > first) {
+		if(syscall(SYS_close_range, (unsigned) first, (unsigned) last, 0u) == 0) {
+			++ml->stats.close_calls;
+			return;
+		}
+
+		ml->close.no_range = (errno == ENOSYS);
+	}
+#endif
+
+	for(int fd = first; fd <= last; ++fd) {
+		close(fd);
+		++ml->stats.close_calls;
+	}
+}
+
+// Closes the fds queued by pml_io_destroy_close, contiguous ranges
+// at once.
+static void flush_close(struct pml* ml) {
+	unsigned n = ml->close.n_fds;
+	if(!n) {
+		return;
+	}
+
+	int* fds = ml->close.fds;
+	sort(fds, n, sizeof(*fds), compare_fd);
+	unsigned first = 0u;
+	for(unsigned i = 1u; i <= n; ++i) {
+		// duplicates are skipped, the fd was already queued
+		if(i < n && fds[i] <= fds[i - 1] + 1) {
+			continue;
+		}
+
+		close_fds(ml, fds[first], fds[i - 1]);
+		first = i;
+	}
+
+	ml->close.n_fds = 0u;
+}
+
 void pml_dispatch(struct pml* ml, struct pollfd* fds, unsigned n_fds) {
 	assert(ml);
 	assert((fds || !n_fds) &&
 		"fds = NULL but n_fds != 0 passed to pml_dispatch");
 	assert((ml->state == state_polled || is_dispatch_state(ml->state)) &&
 		"Invalid mainloop state for calling pml_dispatch");
+	uint64_t perf_start[perf_n_events];
+	bool perf = perf_begin(ml, perf_start);
+
 	unsigned depth = ml->dispatch_depth;
 	++ml->dispatch_depth;
+	if(ml->realtime.enabled && depth == 0) {
+		ml->realtime.dispatch_start = now_ns();
+	}
 
 	switch(ml->state) {
 		case state_polled: // fallthrough
+		case state_dispatch_task:
+			perf_switch(ml, pml_perf_task);
+			if(!dispatch_task(ml)) break; // fallthrough
 		case state_dispatch_defer:
+			perf_switch(ml, pml_perf_defer);
 			if(!dispatch_defer(ml)) break; // fallthrough
 		case state_dispatch_timer:
+			perf_switch(ml, pml_perf_timer);
 			if(!dispatch_timer(ml)) break; // fallthrough
 		case state_dispatch_io:
+			perf_switch(ml, pml_perf_io);
 			if(!dispatch_io(ml, fds, n_fds)) break; // fallthrough
 		case state_dispatch_custom:
+			perf_switch(ml, pml_perf_custom);
 			dispatch_custom(ml, fds, n_fds);
 			break;
 		default:
@@ -563,10 +2691,37 @@ void pml_dispatch(struct pml* ml, struct pollfd* fds, unsigned n_fds) {
 			break;
 	}
 
+	perf_switch(ml, -1);
 	--ml->dispatch_depth;
 	assert(depth == ml->dispatch_depth && "Mainloop depth corrupted");
 	ml->state = state_none;
 	ml->state_data = NULL;
+
+	if(depth == 0) {
+		flush_close(ml);
+		if(ml->log.cb) {
+			pml_log_drain(ml, ml->log.cb, ml->log.data);
+		}
+	}
+
+	if(perf) {
+		perf_end(ml, pml_perf_dispatch, perf_start);
+	}
+
+	++ml->stats.iterations;
+	if(ml->realtime.enabled && depth == 0) {
+		struct pml_realtime_stats* stats = &ml->realtime.stats;
+		int64_t ns = ml->realtime.iteration_ns +
+			now_ns() - ml->realtime.dispatch_start;
+		stats->last_iteration_ns = (uint64_t) ns;
+		if(stats->last_iteration_ns > stats->max_iteration_ns) {
+			stats->max_iteration_ns = stats->last_iteration_ns;
+		}
+		++stats->iterations;
+		ml->realtime.iteration_ns = 0;
+	}
+
+	publish_stats(ml);
 }
 
 int pml_iterate(struct pml* ml, bool block) {
@@ -596,7 +2751,9 @@ unsigned pml_query(struct pml* ml, struct pollfd* fds,
 	// in pml_dispatch. ml->prepared_timeout was already set to 0
 	// though
 	unsigned size = min(n_fds, ml->n_fds) * sizeof(*fds);
-	memcpy(fds, ml->fds, size);
+	if(size) {
+		memcpy(fds, ml->fds, size);
+	}
 	*timeout = ml->prepared_timeout;
 	return ml->n_fds;
 }
@@ -609,44 +2766,276 @@ void pml_for_each_io(struct pml* ml, void (*cb)(struct pml_io*)) {
 	struct pml_io* next = ml->io.first;
 	while((io = next)) {
 		next = io->next;
+#ifdef __linux__
+		// internal source
+		if(io == ml->watch.io) {
+			continue;
+		}
+#endif
 		cb(io);
 	}
+
+#ifdef __linux__
+	// the callback may destroy the io, releasing its slot
+	for(unsigned i = 0u; i < ml->tier.n_slots; ++i) {
+		if((io = ml->tier.slots[i].io) && io != ml->watch.io) {
+			cb(io);
+		}
+	}
+#endif
+}
+
+void pml_for_each_timer(struct pml* ml, void (*cb)(struct pml_timer*)) {
+	assert(ml);
+	assert(cb);
+
+	struct pml_timer* x;
+	struct pml_timer* next = ml->timer.first;
+	while((x = next)) {
+		next = x->next;
+		cb(x);
+	}
+}
+
+void pml_for_each_defer(struct pml* ml, void (*cb)(struct pml_defer*)) {
+	struct pml_defer* x;
+	struct pml_defer* next = ml->defer.first;
+	while((x = next)) {
+		next = x->next;
+		cb(x);
+	}
+}
+
+void pml_for_each_hook(struct pml* ml, void (*cb)(struct pml_hook*)) {
+	assert(ml);
+	assert(cb);
+
+	for(unsigned i = 0u; i < 2; ++i) {
+		struct pml_hook* x;
+		struct pml_hook* next = ml->hook[i].first;
+		while((x = next)) {
+			next = x->next;
+			cb(x);
+		}
+	}
+}
+
+void pml_for_each_custom(struct pml* ml, void (*cb)(struct pml_custom*)) {
+	assert(ml);
+	assert(cb);
+
+	struct pml_custom* x;
+	struct pml_custom* next = ml->custom.first;
+	while((x = next)) {
+		next = x->next;
+		cb(x);
+	}
+}
+
+void pml_stats_read(struct pml* ml, struct pml_stats* stats) {
+	assert(ml);
+	assert(stats);
+
+	uint64_t values[sizeof(*stats) / sizeof(uint64_t)];
+	unsigned seq;
+	do {
+		seq = atomic_load_explicit(&ml->published.seq, memory_order_acquire);
+		for(unsigned i = 0u; i < sizeof(values) / sizeof(values[0]); ++i) {
+			values[i] = atomic_load_explicit(&ml->published.values[i],
+				memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+	} while((seq & 1) ||
+		seq != atomic_load_explicit(&ml->published.seq, memory_order_relaxed));
+
+	memcpy(stats, values, sizeof(*stats));
+}
+
+void pml_set_busy_poll(struct pml* ml, unsigned budget_us) {
+	assert(ml);
+	ml->busy_poll.budget = 1000 * (int64_t) budget_us;
+	ml->busy_poll.interval = 0;
+	ml->busy_poll.last_arrival = now_ns();
+}
+
+void pml_get_busy_poll_stats(struct pml* ml,
+		struct pml_busy_poll_stats* stats) {
+	assert(ml);
+	assert(stats);
+	*stats = ml->busy_poll.stats;
+}
+
+// realtime
+// Grows the array to cap elements and touches the unused part, so
+// that it's faulted in before locking.
+static void* prealloc(struct pml* ml, void* data, unsigned* cap, unsigned n,
+		size_t size) {
+	unsigned old = *cap;
+	data = grow(ml, data, cap, n, size);
+	memset((char*) data + old * size, 0, (*cap - old) * size);
+	return data;
+}
+
+int pml_set_realtime(struct pml* ml, const struct pml_realtime* rt) {
+	assert(ml);
+	if(ml->realtime.enabled) {
+		lock_arrays(ml, false);
+		ml->realtime.enabled = false;
+	}
+
+	if(!rt) {
+		return 0;
+	}
+
+	ml->fds = prealloc(ml, ml->fds, &ml->cap_fds, rt->max_fds,
+		sizeof(*ml->fds));
+
+	// create the heaps for the common clocks now
+	get_heap_id(ml, CLOCK_REALTIME);
+	get_heap_id(ml, CLOCK_MONOTONIC);
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		h->timers = prealloc(ml, h->timers, &h->cap, rt->max_timers,
+			sizeof(*h->timers));
+		if(h->flat) {
+			h->deadlines = realloc(h->deadlines, h->cap * sizeof(*h->deadlines));
+		}
+	}
+
+	ml->timer.pending = prealloc(ml, ml->timer.pending,
+		&ml->timer.cap_pending, rt->max_timers, sizeof(*ml->timer.pending));
+	if(ml->timer.flat) {
+		ml->timer.scratch_ids = prealloc(ml, ml->timer.scratch_ids,
+			&ml->timer.cap_scratch_ids, rt->max_timers,
+			sizeof(*ml->timer.scratch_ids));
+		ml->timer.scratch_expired = prealloc(ml, ml->timer.scratch_expired,
+			&ml->timer.cap_scratch_expired, rt->max_timers,
+			sizeof(*ml->timer.scratch_expired));
+	}
+
+	ml->task.heap = prealloc(ml, ml->task.heap, &ml->task.cap_heap,
+		rt->max_tasks, sizeof(*ml->task.heap));
+	ml->task.run = prealloc(ml, ml->task.run, &ml->task.cap_run,
+		rt->max_tasks, sizeof(*ml->task.run));
+#ifdef __linux__
+	// tiering might be enabled later on, io_demote keeps ios hot when
+	// there are no free slots
+	unsigned cap_free = ml->tier.cap_slots;
+	ml->tier.slots = prealloc(ml, ml->tier.slots, &ml->tier.cap_slots,
+		rt->max_fds, sizeof(*ml->tier.slots));
+	ml->tier.free_slots = prealloc(ml, ml->tier.free_slots, &cap_free,
+		rt->max_fds, sizeof(*ml->tier.free_slots));
+	assert(cap_free == ml->tier.cap_slots);
+	ml->tier.ready = prealloc(ml, ml->tier.ready, &ml->tier.cap_ready,
+		128, sizeof(*ml->tier.ready));
+#endif
+
+	int ret = 0;
+	if(lock_arrays(ml, true) != 0) {
+		ret = -errno;
+	}
+
+	if(rt->priority) {
+		struct sched_param param = {.sched_priority = rt->priority};
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(err && !ret) {
+			ret = -err;
+		}
+	}
+
+	memset(&ml->realtime.stats, 0, sizeof(ml->realtime.stats));
+	ml->realtime.enabled = true;
+	return ret;
+}
+
+void pml_get_realtime_stats(struct pml* ml, struct pml_realtime_stats* stats) {
+	assert(ml);
+	assert(stats);
+	*stats = ml->realtime.stats;
+}
+
+static void lag_probe_cb(struct pml_timer* t) {
+	struct pml* ml = t->data;
+
+	// the probe itself was the only callback since it was armed: the
+	// mainloop is idle, don't wake it up again. Stays armed while
+	// shedding, so that the lag can recover.
+	uint64_t work = lag_work(ml);
+	bool idle = (work == ml->lag.work + 1);
+	ml->lag.work = work;
+	if(!idle || ml->lag.shedding) {
+		timer_set(t, timer_heap(t)->now + ml->lag.high);
+	}
 }
 
-void pml_for_each_timer(struct pml* ml, void (*cb)(struct pml_timer*)) {
+void pml_set_lag_monitor(struct pml* ml, const struct timespec* high,
+		const struct timespec* low, pml_lag_cb cb, void* data) {
 	assert(ml);
-	assert(cb);
+	assert(!high == !low);
+
+	if(!ml->lag.probe.pml) {
+		ml->lag.probe.pml = ml;
+		ml->lag.probe.cb = lag_probe_cb;
+		ml->lag.probe.data = ml;
+		ml->lag.probe.queue_id = UINT_MAX;
+		ml->lag.probe.clock_id = get_heap_id(ml, CLOCK_MONOTONIC);
+	}
 
-	struct pml_timer* x;
-	struct pml_timer* next = ml->timer.first;
-	while((x = next)) {
-		next = x->next;
-		cb(x);
+	ml->lag.cb = cb;
+	ml->lag.data = data;
+	ml->lag.sampled = false;
+	if(!high) {
+		ml->lag.high = 0;
+		timer_unqueue(&ml->lag.probe);
+		ml->lag.probe.enabled = false;
+		if(ml->lag.shedding) {
+			ml->lag.shedding = false;
+			ml->rebuild_fds = true;
+		}
+		return;
 	}
+
+	ml->lag.high = timespec_ns(high);
+	ml->lag.low = timespec_ns(low);
+	assert(ml->lag.high > 0 && ml->lag.low <= ml->lag.high);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timer_set(&ml->lag.probe, timespec_ns(&now) + ml->lag.high);
+	ml->lag.work = lag_work(ml);
 }
 
-void pml_for_each_defer(struct pml* ml, void (*cb)(struct pml_defer*)) {
-	struct pml_defer* x;
-	struct pml_defer* next = ml->defer.first;
-	while((x = next)) {
-		next = x->next;
-		cb(x);
-	}
+bool pml_is_shedding(struct pml* ml) {
+	assert(ml);
+	return ml->lag.shedding;
 }
 
-void pml_for_each_custom(struct pml* ml, void (*cb)(struct pml_custom*)) {
+#ifdef __linux__
+void pml_set_io_tiering(struct pml* ml, unsigned cold_after) {
 	assert(ml);
-	assert(cb);
+	ml->tier.cold_after = cold_after;
+	ml->tier.next_scan = ml->stats.iterations + cold_after;
+	if(cold_after) {
+		return;
+	}
 
-	struct pml_custom* x;
-	struct pml_custom* next = ml->custom.first;
-	while((x = next)) {
-		next = x->next;
-		cb(x);
+	for(unsigned i = 0u; i < ml->tier.n_slots; ++i) {
+		if(ml->tier.slots[i].io) {
+			io_promote(ml->tier.slots[i].io);
+		}
 	}
 }
+#endif
 
 // pml_io
+static void io_deadline_cb(struct pml_timer* t) {
+	struct pml_io* io = t->data;
+	struct sample_slot slot = sample_enter(pml_sample_io, io,
+		(generic_fn) io->cb, io->pml->dispatch_depth);
+	io->cb(io, pml_io_timeout);
+	sample_leave(slot);
+}
+
 struct pml_io* pml_io_new(struct pml* ml, int fd,
 		unsigned events, pml_io_cb cb) {
 	assert(ml);
@@ -660,18 +3049,24 @@ struct pml_io* pml_io_new(struct pml* ml, int fd,
 	io->events = events;
 	io->cb = cb;
 	io->fd_id = UINT_MAX;
+	io->batch_id = UINT_MAX;
 
-	ml->rebuild_fds = true;
-	++ml->n_io;
+	io->deadline.pml = ml;
+	io->deadline.cb = io_deadline_cb;
+	io->deadline.data = io;
+	io->deadline.clock_id = get_heap_id(ml, CLOCK_MONOTONIC);
+	io->deadline.lazy = true;
+	io->deadline.queue_id = UINT_MAX;
 
-	if(!ml->io.first) {
-		ml->io.first = io;
-	} else {
-		ml->io.last->next = io;
-		io->prev = ml->io.last;
-	}
-	ml->io.last = io;
+#ifdef __linux__
+	io->last_active = ml->stats.iterations;
+	io->cold_id = UINT_MAX;
+	io->ready_id = UINT_MAX;
+#endif
 
+	ml->rebuild_fds = true;
+	++ml->n_io;
+	link_io(io);
 	return io;
 }
 
@@ -722,14 +3117,66 @@ void pml_io_destroy(struct pml_io* io) {
 	// Could even store "free blocks sizes" and do the same for custom
 	// sources by using fds[i].events as block size.
 	ml->rebuild_fds = true;
+	timer_unqueue(&io->deadline);
+
+	if(io->batch_id != UINT_MAX) {
+		io->group->batch[io->batch_id] = NULL;
+	}
+	if(io->group) {
+		--io->group->n_members;
+	}
+
+#ifdef __linux__
+	if(io->ready_id != UINT_MAX) {
+		ml->tier.ready[io->ready_id] = NULL;
+	}
+	if(io->cold_id != UINT_MAX) {
+		io_release_cold(io);
+	}
+#endif
+
 	destroy_io(io);
 }
 
+void pml_io_destroy_close(struct pml_io* io) {
+	if(!io) {
+		return;
+	}
+
+	struct pml* ml = io->pml;
+	int fd = io->fd;
+	pml_io_destroy(io);
+
+	// not using grow, destroying sources is allowed to allocate
+	// in realtime mode
+	if(ml->close.n_fds == ml->close.cap_fds) {
+		ml->close.cap_fds = ml->close.cap_fds ? 2 * ml->close.cap_fds : 16;
+		ml->close.fds = realloc(ml->close.fds,
+			ml->close.cap_fds * sizeof(*ml->close.fds));
+	}
+
+	ml->close.fds[ml->close.n_fds++] = fd;
+	if(ml->dispatch_depth == 0) {
+		flush_close(ml);
+	}
+}
+
 void pml_io_set_events(struct pml_io* io, unsigned events) {
 	assert(io);
 	io->events = events;
+#ifdef __linux__
+	if(io->cold_id != UINT_MAX) {
+		struct epoll_event ev = {
+			.events = events,
+			.data.u64 = ((uint64_t) io->pml->tier.slots[io->cold_id].gen << 32) |
+				io->cold_id,
+		};
+		epoll_ctl(io->pml->tier.epfd, EPOLL_CTL_MOD, io->fd, &ev);
+		return;
+	}
+#endif
 	if(io->fd_id != UINT_MAX && !io->pml->rebuild_fds) {
-		io->pml->fds[io->fd_id].events = events;
+		io->pml->fds[io->fd_id].events = io_poll_events(io);
 	}
 }
 
@@ -737,6 +3184,40 @@ unsigned pml_io_get_events(struct pml_io* io) {
 	return io->events;
 }
 
+void pml_io_set_deadline(struct pml_io* io, const struct timespec* rel) {
+	assert(io);
+	if(rel && !io->pml->dispatch_depth) {
+		// the time of the last dispatch might be long ago
+		timer_set(&io->deadline, add_ns(now_ns(), timespec_ns(rel)));
+	} else if(rel) {
+		pml_timer_set_time_rel(&io->deadline, *rel);
+	} else {
+		pml_timer_disable(&io->deadline);
+	}
+}
+
+void pml_io_set_sheddable(struct pml_io* io, bool sheddable) {
+	assert(io);
+	if(io->sheddable == sheddable) {
+		return;
+	}
+
+	io->sheddable = sheddable;
+#ifdef __linux__
+	if(sheddable && io->cold_id != UINT_MAX) {
+		io_promote(io);
+	}
+#endif
+	if(io->pml->lag.shedding) {
+		io->pml->rebuild_fds = true;
+	}
+}
+
+bool pml_io_is_sheddable(struct pml_io* io) {
+	assert(io);
+	return io->sheddable;
+}
+
 struct pml* pml_io_get_pml(struct pml_io* io) {
 	assert(io);
 	assert(io->pml);
@@ -748,112 +3229,478 @@ pml_io_cb pml_io_get_cb(struct pml_io* io) {
 	return io->cb;
 }
 
+void pml_io_set_cb(struct pml_io* io, pml_io_cb cb) {
+	assert(io);
+	assert(cb);
+	io->cb = cb;
+}
+
+// pml_io_group
+struct pml_io_group* pml_io_group_new(struct pml* ml, pml_io_group_cb cb) {
+	assert(ml);
+	assert(cb);
+
+	struct pml_io_group* g = calloc(1, sizeof(*g));
+	g->pml = ml;
+	g->cb = cb;
+
+	if(!ml->io_group.first) {
+		ml->io_group.first = g;
+	} else {
+		ml->io_group.last->next = g;
+		g->prev = ml->io_group.last;
+	}
+	ml->io_group.last = g;
+
+	return g;
+}
+
+void pml_io_group_set_data(struct pml_io_group* g, void* data) {
+	assert(g);
+	g->data = data;
+}
+
+void* pml_io_group_get_data(struct pml_io_group* g) {
+	assert(g);
+	return g->data;
+}
+
+void pml_io_group_destroy(struct pml_io_group* g) {
+	if(!g) {
+		return;
+	}
+
+	struct pml* ml = g->pml;
+	assert(g->n_members == 0 && "Destroying io group with io sources");
+	assert(!g->destroyed);
+	if(g->queued) {
+		struct pml_io_group* prev = NULL;
+		struct pml_io_group* it = ml->io_group.ready_first;
+		while(it != g) {
+			prev = it;
+			it = it->ready_next;
+		}
+
+		if(prev) {
+			prev->ready_next = g->ready_next;
+		} else {
+			ml->io_group.ready_first = g->ready_next;
+		}
+		if(ml->io_group.ready_last == g) {
+			ml->io_group.ready_last = prev;
+		}
+		g->queued = false;
+	}
+
+	if(g->running) {
+		g->destroyed = true;
+		return;
+	}
+
+	free_io_group(g);
+}
+
+pml_io_group_cb pml_io_group_get_cb(struct pml_io_group* g) {
+	assert(g);
+	return g->cb;
+}
+
+struct pml* pml_io_group_get_pml(struct pml_io_group* g) {
+	assert(g);
+	return g->pml;
+}
+
+void pml_io_set_group(struct pml_io* io, struct pml_io_group* g) {
+	assert(io);
+	assert(!g || g->pml == io->pml);
+	if(io->group == g) {
+		return;
+	}
+
+	// reserve space for twice the members, so dispatching won't allocate.
+	// Arrays detached by running callbacks are allocated again here.
+	unsigned reserve = g ? 2 * (g->n_members + 1) : 0u;
+	if(g && g->cap_batch < reserve) {
+		g->cap_batch = 2 * reserve;
+		g->batch = realloc(g->batch, g->cap_batch * sizeof(*g->batch));
+	}
+	if(g && g->cap_events < reserve) {
+		g->cap_events = g->cap_batch;
+		g->events = realloc(g->events, g->cap_events * sizeof(*g->events));
+		g->spare = realloc(g->spare, g->cap_events * sizeof(*g->spare));
+	}
+
+	// a batched event is dropped, the fd is still ready when polling
+	// the next time
+	if(io->group) {
+		if(io->batch_id != UINT_MAX) {
+			io->group->batch[io->batch_id] = NULL;
+			io->batch_id = UINT_MAX;
+		}
+		--io->group->n_members;
+	}
+
+	io->group = g;
+	if(g) {
+		++g->n_members;
+	}
+}
+
+struct pml_io_group* pml_io_get_group(struct pml_io* io) {
+	assert(io);
+	return io->group;
+}
+
 // pml_timer
 struct pml_timer* pml_timer_new(struct pml* ml,
 		const struct timespec* time, pml_timer_cb cb) {
 	assert(ml);
 	assert(cb);
 
-	struct pml_timer* timer = calloc(1, sizeof(*timer));
-	timer->pml = ml;
-	timer->cb = cb;
-	timer->clock = CLOCK_REALTIME;
-	timer->enabled = time;
-	if(time) {
-		timer->time = *time;
+	struct pml_timer* timer = calloc(1, sizeof(*timer));
+	timer->pml = ml;
+	timer->cb = cb;
+	timer->clock_id = get_heap_id(ml, CLOCK_REALTIME);
+	timer->queue_id = UINT_MAX;
+	timer->enabled = time;
+	if(time) {
+		timer->time = timespec_ns(time);
+		timer_queue(timer);
+	}
+
+	if(!ml->timer.first) {
+		ml->timer.first = timer;
+	} else {
+		ml->timer.last->next = timer;
+		timer->prev = ml->timer.last;
+	}
+	ml->timer.last = timer;
+
+	return timer;
+}
+
+void pml_timer_set_time(struct pml_timer* timer, struct timespec time) {
+	assert(timer);
+	timer_set(timer, timespec_ns(&time));
+}
+
+int pml_timer_set_time_rel(struct pml_timer* timer, struct timespec time) {
+	assert(timer);
+
+	int64_t now;
+	struct timer_heap* h = timer_heap(timer);
+	if(timer->lazy && h->now_valid) {
+		now = h->now;
+	} else {
+		struct timespec ts;
+		int res = clock_gettime(h->clock, &ts);
+		if(res != 0) {
+			int err = errno;
+			pml_timer_disable(timer);
+			log_msg(timer->pml, "clock_gettime: %s (%d)", strerror(err), err);
+			errno = err;
+			return res;
+		}
+		now = timespec_ns(&ts);
+	}
+
+	timer_set(timer, add_ns(now, timespec_ns(&time)));
+	return 0;
+}
+
+void pml_timer_set_lazy(struct pml_timer* timer, bool lazy) {
+	assert(timer);
+	if(timer->lazy == lazy) {
+		return;
+	}
+
+	// bring the timer into a consistent heap state
+	if(!lazy && !timer->pending && timer->queue_id != UINT_MAX) {
+		timer_unqueue(timer);
+		if(timer->enabled) {
+			timer_queue(timer);
+		}
+	}
+
+	timer->lazy = lazy;
+}
+
+bool pml_timer_is_lazy(struct pml_timer* timer) {
+	assert(timer);
+	return timer->lazy;
+}
+
+bool pml_timer_is_enabled(struct pml_timer* timer) {
+	assert(timer);
+	return timer->enabled;
+}
+
+void pml_timer_disable(struct pml_timer* timer) {
+	assert(timer);
+	// lazy timers are removed from the heap when they reach the root,
+	// except with flat storage where removing them is cheap
+	if(!timer->lazy || timer->pending || timer_heap(timer)->flat) {
+		timer_unqueue(timer);
+	}
+	timer->enabled = false;
+}
+
+void pml_timer_set_clock(struct pml_timer* timer, pml_clockid clock) {
+	assert(timer);
+	timer_unqueue(timer);
+	timer->clock_id = get_heap_id(timer->pml, clock);
+	timer->enabled = false;
+}
+
+struct timespec pml_timer_get_time(struct pml_timer* timer) {
+	assert(timer);
+	return ns_timespec(timer->time);
+}
+
+clockid_t pml_timer_get_clock(struct pml_timer* timer) {
+	assert(timer);
+	return timer_heap(timer)->clock;
+}
+
+void pml_timer_set_data(struct pml_timer* timer, void* data) {
+	assert(timer);
+	timer->data = data;
+}
+
+void* pml_timer_get_data(struct pml_timer* timer) {
+	assert(timer);
+	return timer->data;
+}
+
+void pml_timer_destroy(struct pml_timer* timer) {
+	if(!timer) {
+		return;
+	}
+
+	assert(timer->pml);
+	timer_unqueue(timer);
+	if(timer->group) {
+		--timer->group->n_members;
+	}
+	destroy_timer(timer);
+}
+
+struct pml* pml_timer_get_pml(struct pml_timer* timer) {
+	assert(timer);
+	assert(timer->pml);
+	return timer->pml;
+}
+
+void pml_set_timer_dispatch_limit(struct pml* ml, unsigned limit) {
+	assert(ml);
+	ml->timer.dispatch_limit = limit;
+}
+
+void pml_set_timer_storage(struct pml* ml, enum pml_timer_storage storage) {
+	assert(ml);
+	assert(storage == pml_timer_storage_heap ||
+		storage == pml_timer_storage_flat);
+
+	bool flat = (storage == pml_timer_storage_flat);
+	ml->timer.flat = flat;
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		if(h->flat == flat) {
+			continue;
+		}
+
+		h->flat = flat;
+		if(!flat) {
+			free(h->deadlines);
+			h->deadlines = NULL;
+			for(unsigned j = h->size / 2; j-- > 0;) {
+				heap_down(h, j);
+			}
+			continue;
+		}
+
+		// apply the deferred changes of all lazy timers, see timer_heap.
+		// Iterating backwards since heap_remove moves the last timer.
+		h->deadlines = realloc(h->deadlines, h->cap * sizeof(*h->deadlines));
+		for(unsigned j = h->size; j-- > 0;) {
+			struct pml_timer* t = h->timers[j];
+			if(!t->enabled) {
+				heap_remove(h, j);
+			} else {
+				t->queue_time = t->time;
+				heap_set(h, j, t);
+			}
+		}
+	}
+}
+
+pml_timer_cb pml_timer_get_cb(struct pml_timer* timer) {
+	assert(timer);
+	return timer->cb;
+}
+
+void pml_timer_set_cb(struct pml_timer* timer, pml_timer_cb cb) {
+	assert(timer);
+	assert(cb);
+	timer->cb = cb;
+}
+
+// pml_timer_group
+static void free_timer_group(struct pml_timer_group* g) {
+	struct pml* ml = g->pml;
+	if(g->next) g->next->prev = g->prev;
+	if(g->prev) g->prev->next = g->next;
+	if(g == ml->timer.group.first) ml->timer.group.first = g->next;
+	if(g == ml->timer.group.last) ml->timer.group.last = g->prev;
+	free(g->batch);
+	free(g->cb_data);
+	free(g);
+}
+
+static void timer_group_dispatch(struct pml_timer* entry) {
+	struct pml_timer_group* g = entry->data;
+	g->cb_data = grow(g->pml, g->cb_data, &g->cap_cb_data, g->n_batch,
+		sizeof(*g->cb_data));
+
+	void** data = g->cb_data;
+	unsigned cap = g->cap_cb_data;
+	unsigned count = 0u;
+	for(unsigned i = 0u; i < g->n_batch; ++i) {
+		struct pml_timer* t = g->batch[i];
+		if(!t) {
+			continue;
+		}
+
+		t->pending = false;
+		t->queue_id = UINT_MAX;
+		t->enabled = false;
+		data[count++] = t->data;
 	}
 
-	if(!ml->timer.first) {
-		ml->timer.first = timer;
-	} else {
-		ml->timer.last->next = timer;
-		timer->prev = ml->timer.last;
+	g->n_batch = 0u;
+	if(!count) {
+		return;
 	}
-	ml->timer.last = timer;
 
-	return timer;
+	g->cb_data = NULL;
+	g->cap_cb_data = 0u;
+	++g->running;
+	struct sample_slot slot = sample_enter(pml_sample_timer_group, g,
+		(generic_fn) g->cb, g->pml->dispatch_depth);
+	g->cb(g, data, count);
+	sample_leave(slot);
+	--g->running;
+
+	if(g->destroyed) {
+		free(data);
+		if(!g->running) {
+			free_timer_group(g);
+		}
+	} else if(!g->cb_data) {
+		g->cb_data = data;
+		g->cap_cb_data = cap;
+	} else {
+		free(data);
+	}
 }
 
-void pml_timer_set_time(struct pml_timer* timer, struct timespec time) {
-	assert(timer);
-	timer->enabled = true;
-	timer->time = time;
-}
+struct pml_timer_group* pml_timer_group_new(struct pml* ml,
+		pml_timer_group_cb cb) {
+	assert(ml);
+	assert(cb);
 
-int pml_timer_set_time_rel(struct pml_timer* timer, struct timespec time) {
-	assert(timer);
-	int res = clock_gettime(timer->clock, &timer->time);
-	if(res != 0) {
-		timer->enabled = false;
-		printf("clock_gettime: %s (%d)\n", strerror(errno), errno);
-		return res;
+	struct pml_timer_group* g = calloc(1, sizeof(*g));
+	g->pml = ml;
+	g->cb = cb;
+	g->entry.pml = ml;
+	g->entry.cb = timer_group_dispatch;
+	g->entry.data = g;
+	g->entry.queue_id = UINT_MAX;
+
+	if(!ml->timer.group.first) {
+		ml->timer.group.first = g;
+	} else {
+		ml->timer.group.last->next = g;
+		g->prev = ml->timer.group.last;
 	}
+	ml->timer.group.last = g;
 
-	timer->enabled = true;
-	timer->time.tv_nsec += time.tv_nsec;
-	timer->time.tv_sec += time.tv_sec;
-	return 0;
+	return g;
 }
 
-bool pml_timer_is_enabled(struct pml_timer* timer) {
-	assert(timer);
-	return timer->enabled;
+void pml_timer_group_set_data(struct pml_timer_group* g, void* data) {
+	assert(g);
+	g->data = data;
 }
 
-void pml_timer_disable(struct pml_timer* timer) {
-	assert(timer);
-	timer->enabled = false;
+void* pml_timer_group_get_data(struct pml_timer_group* g) {
+	assert(g);
+	return g->data;
 }
 
-void pml_timer_set_clock(struct pml_timer* timer, pml_clockid clock) {
-	assert(timer);
-	timer->clock = clock;
-	timer->enabled = false;
-}
+void pml_timer_group_destroy(struct pml_timer_group* g) {
+	if(!g) {
+		return;
+	}
 
-struct timespec pml_timer_get_time(struct pml_timer* timer) {
-	assert(timer);
-	return timer->time;
-}
+	assert(g->n_members == 0 && "Destroying timer group with timers");
+	assert(!g->destroyed);
+	timer_unqueue(&g->entry);
+	if(g->running) {
+		g->destroyed = true;
+		return;
+	}
 
-clockid_t pml_timer_get_clock(struct pml_timer* timer) {
-	assert(timer);
-	return timer->clock;
+	free_timer_group(g);
 }
 
-void pml_timer_set_data(struct pml_timer* timer, void* data) {
-	assert(timer);
-	timer->data = data;
+pml_timer_group_cb pml_timer_group_get_cb(struct pml_timer_group* g) {
+	assert(g);
+	return g->cb;
 }
 
-void* pml_timer_get_data(struct pml_timer* timer) {
-	assert(timer);
-	return timer->data;
+struct pml* pml_timer_group_get_pml(struct pml_timer_group* g) {
+	assert(g);
+	return g->pml;
 }
 
-void pml_timer_destroy(struct pml_timer* timer) {
-	if(!timer) {
+void pml_timer_set_group(struct pml_timer* timer, struct pml_timer_group* g) {
+	assert(timer);
+	assert(!g || g->pml == timer->pml);
+	if(timer->group == g) {
 		return;
 	}
 
-	assert(timer->pml);
-	if(timer->pml->state_data == timer) {
-		assert(timer->pml->state == state_dispatch_timer);
-		timer->pml->state_data = timer->next;
+	// reserve space for all members, so dispatching won't allocate
+	if(g && g->cap_batch <= g->n_members) {
+		g->cap_batch = 2 * (g->n_members + 1);
+		g->batch = realloc(g->batch, g->cap_batch * sizeof(*g->batch));
+	}
+	if(g && g->cap_cb_data <= g->n_members) {
+		g->cap_cb_data = g->cap_batch;
+		g->cb_data = realloc(g->cb_data, g->cap_cb_data * sizeof(*g->cb_data));
 	}
 
-	destroy_timer(timer);
-}
+	// an expired timer stays expired, it's just collected again
+	// in the next iteration
+	if(timer->pending) {
+		timer_unqueue(timer);
+		timer_queue(timer);
+	}
 
-struct pml* pml_timer_get_pml(struct pml_timer* timer) {
-	assert(timer);
-	assert(timer->pml);
-	return timer->pml;
+	if(timer->group) {
+		--timer->group->n_members;
+	}
+
+	timer->group = g;
+	if(g) {
+		++g->n_members;
+	}
 }
 
-pml_timer_cb pml_timer_get_cb(struct pml_timer* timer) {
+struct pml_timer_group* pml_timer_get_group(struct pml_timer* timer) {
 	assert(timer);
-	return timer->cb;
+	return timer->group;
 }
 
 // pml_defer
@@ -931,6 +3778,43 @@ pml_defer_cb pml_defer_get_cb(struct pml_defer* defer) {
 	return defer->cb;
 }
 
+void pml_defer_set_cb(struct pml_defer* defer, pml_defer_cb cb) {
+	assert(defer);
+	assert(cb);
+	defer->cb = cb;
+}
+
+// tasks
+void pml_schedule(struct pml* ml, pml_task_fn fn, void* arg,
+		struct timespec deadline) {
+	assert(ml);
+	assert(fn);
+
+	ml->task.heap = grow(ml, ml->task.heap, &ml->task.cap_heap,
+		ml->task.n_heap + 1, sizeof(*ml->task.heap));
+
+	struct task t = {
+		.deadline = timespec_ns(&deadline),
+		.seq = ml->task.seq++,
+		.fn = fn,
+		.arg = arg,
+	};
+
+	struct task* heap = ml->task.heap;
+	unsigned i = ml->task.n_heap++;
+	while(i > 0) {
+		unsigned parent = (i - 1) / 2;
+		if(!task_less(&t, &heap[parent])) {
+			break;
+		}
+
+		heap[i] = heap[parent];
+		i = parent;
+	}
+
+	heap[i] = t;
+}
+
 // pml_custom
 struct pml_custom* pml_custom_new(struct pml* ml, const struct pml_custom_impl* impl) {
 	assert(ml);
@@ -1003,3 +3887,534 @@ const struct pml_custom_impl* pml_custom_get_impl(struct pml_custom* custom) {
 	assert(custom);
 	return custom->impl;
 }
+
+// pml_hook
+struct pml_hook* pml_hook_new(struct pml* ml, enum pml_hook_type type,
+		pml_hook_cb cb) {
+	assert(ml);
+	assert(cb);
+	assert(type == pml_hook_prepare || type == pml_hook_check);
+
+	struct pml_hook* hook = calloc(1, sizeof(*hook));
+	hook->pml = ml;
+	hook->cb = cb;
+	hook->type = type;
+
+	if(!ml->hook[type].first) {
+		ml->hook[type].first = hook;
+	} else {
+		ml->hook[type].last->next = hook;
+		hook->prev = ml->hook[type].last;
+	}
+	ml->hook[type].last = hook;
+
+	return hook;
+}
+
+void pml_hook_set_data(struct pml_hook* hook, void* data) {
+	assert(hook);
+	hook->data = data;
+}
+
+void* pml_hook_get_data(struct pml_hook* hook) {
+	assert(hook);
+	return hook->data;
+}
+
+void pml_hook_destroy(struct pml_hook* hook) {
+	if(!hook) {
+		return;
+	}
+
+	struct pml* ml = hook->pml;
+	assert(ml);
+	if(ml->hook_next == hook) {
+		ml->hook_next = hook->next;
+	}
+
+	if(hook->next) hook->next->prev = hook->prev;
+	if(hook->prev) hook->prev->next = hook->next;
+	if(hook == ml->hook[hook->type].first) ml->hook[hook->type].first = hook->next;
+	if(hook == ml->hook[hook->type].last) ml->hook[hook->type].last = hook->prev;
+	free(hook);
+}
+
+enum pml_hook_type pml_hook_get_type(struct pml_hook* hook) {
+	assert(hook);
+	return hook->type;
+}
+
+pml_hook_cb pml_hook_get_cb(struct pml_hook* hook) {
+	assert(hook);
+	return hook->cb;
+}
+
+struct pml* pml_hook_get_pml(struct pml_hook* hook) {
+	assert(hook);
+	assert(hook->pml);
+	return hook->pml;
+}
+
+// snapshot
+// Binary format: snapshot_header, then n_io snapshot_io records, then
+// n_timer snapshot_timer records. Native endianness, it's only meant to
+// be passed between processes on the same machine.
+enum {
+	snapshot_magic = 0x4c4d5000, // "\0PML"
+	snapshot_version = 2,
+};
+
+struct snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t n_io;
+	uint32_t n_timer;
+};
+
+struct snapshot_io {
+	uint64_t token;
+	uint32_t fd_id; // index into the fds array
+	uint32_t events;
+	int64_t deadline; // CLOCK_MONOTONIC nanoseconds, see pml_io_set_deadline
+	uint32_t flags;
+	uint32_t pad;
+};
+
+struct snapshot_timer {
+	uint64_t token;
+	int64_t time; // nanoseconds
+	int32_t clock;
+	uint32_t flags;
+};
+
+enum {
+	snapshot_timer_enabled = 1,
+	snapshot_timer_lazy = 2,
+};
+
+enum {
+	snapshot_io_deadline = 1,
+};
+
+// Appends the record of the io, if it should be saved.
+static void snapshot_io(struct pml_io* io, char* out, size_t size, size_t* off,
+		struct snapshot_header* header, int* fds,
+		const struct pml_snapshot_impl* impl, void* ud) {
+	uint64_t token;
+	if(!impl->save_io(ud, io, &token)) {
+		return;
+	}
+
+	if(*off + sizeof(struct snapshot_io) <= size) {
+		struct snapshot_io rec = {
+			.token = token,
+			.fd_id = header->n_io,
+			.events = io->events,
+			.deadline = io->deadline.time,
+			.flags = io->deadline.enabled ? snapshot_io_deadline : 0,
+		};
+		memcpy(out + *off, &rec, sizeof(rec));
+		if(fds) {
+			fds[header->n_io] = io->fd;
+		}
+	}
+
+	++header->n_io;
+	*off += sizeof(struct snapshot_io);
+}
+
+size_t pml_snapshot(struct pml* ml, void* buf, size_t size, int* fds,
+		const struct pml_snapshot_impl* impl, void* ud) {
+	assert(ml);
+	assert(impl && impl->save_io && impl->save_timer);
+	assert(buf || !size);
+
+	char* out = buf;
+	size_t off = sizeof(struct snapshot_header);
+	struct snapshot_header header = {
+		.magic = snapshot_magic,
+		.version = snapshot_version,
+	};
+
+	for(struct pml_io* io = ml->io.first; io; io = io->next) {
+#ifdef __linux__
+		if(io == ml->watch.io) {
+			continue;
+		}
+#endif
+		snapshot_io(io, out, size, &off, &header, fds, impl, ud);
+	}
+
+#ifdef __linux__
+	for(unsigned i = 0u; i < ml->tier.n_slots; ++i) {
+		struct pml_io* io = ml->tier.slots[i].io;
+		if(io && io != ml->watch.io) {
+			snapshot_io(io, out, size, &off, &header, fds, impl, ud);
+		}
+	}
+#endif
+
+	for(struct pml_timer* t = ml->timer.first; t; t = t->next) {
+		uint64_t token;
+		if(!impl->save_timer(ud, t, &token)) {
+			continue;
+		}
+
+		if(off + sizeof(struct snapshot_timer) <= size) {
+			struct snapshot_timer rec = {
+				.token = token,
+				.time = t->time,
+				.clock = timer_heap(t)->clock,
+				.flags = (t->enabled ? snapshot_timer_enabled : 0) |
+					(t->lazy ? snapshot_timer_lazy : 0),
+			};
+			memcpy(out + off, &rec, sizeof(rec));
+		}
+
+		++header.n_timer;
+		off += sizeof(struct snapshot_timer);
+	}
+
+	if(off <= size) {
+		memcpy(out, &header, sizeof(header));
+	}
+
+	return off;
+}
+
+int pml_restore(struct pml* ml, const void* buf, size_t size,
+		const int* fds, unsigned n_fds,
+		const struct pml_snapshot_impl* impl, void* ud) {
+	assert(ml);
+	assert(impl && impl->load_io && impl->load_timer);
+
+	const char* in = buf;
+	struct snapshot_header header;
+	if(size < sizeof(header)) {
+		return -1;
+	}
+
+	memcpy(&header, in, sizeof(header));
+	if(header.magic != snapshot_magic || header.version != snapshot_version ||
+			n_fds < header.n_io) {
+		return -1;
+	}
+
+	// checked in steps to avoid overflows
+	size_t left = size - sizeof(header);
+	if(header.n_io > left / sizeof(struct snapshot_io)) {
+		return -1;
+	}
+	left -= header.n_io * sizeof(struct snapshot_io);
+	if(header.n_timer > left / sizeof(struct snapshot_timer)) {
+		return -1;
+	}
+
+	// validate the io records before creating any source: every fd
+	// must be referenced by at most one record
+	if(header.n_io) {
+		bool* used = calloc(n_fds, sizeof(*used));
+		size_t off = sizeof(header);
+		bool valid = true;
+		for(unsigned i = 0u; valid && i < header.n_io; ++i) {
+			struct snapshot_io rec;
+			memcpy(&rec, in + off, sizeof(rec));
+			off += sizeof(rec);
+
+			valid = rec.fd_id < n_fds && !used[rec.fd_id];
+			if(valid) {
+				used[rec.fd_id] = true;
+			}
+		}
+
+		free(used);
+		if(!valid) {
+			return -1;
+		}
+	}
+
+	size_t off = sizeof(header);
+	for(unsigned i = 0u; i < header.n_io; ++i) {
+		struct snapshot_io rec;
+		memcpy(&rec, in + off, sizeof(rec));
+		off += sizeof(rec);
+
+		int fd = fds[rec.fd_id];
+		pml_io_cb cb = NULL;
+		void* data = NULL;
+		if(!impl->load_io(ud, rec.token, fd, &cb, &data)) {
+			continue;
+		}
+
+		struct pml_io* io = pml_io_new(ml, fd, rec.events, cb);
+		io->data = data;
+
+		// CLOCK_MONOTONIC is system-wide, so the absolute deadline
+		// stays valid in another process
+		if(rec.flags & snapshot_io_deadline) {
+			timer_set(&io->deadline, rec.deadline);
+		}
+	}
+
+	// Timers are first only appended to the heaps, the heaps are then
+	// built at once. Otherwise the same as calling pml_timer_new
+	// and pml_timer_set_time for each of them.
+	for(unsigned i = 0u; i < header.n_timer; ++i) {
+		struct snapshot_timer rec;
+		memcpy(&rec, in + off, sizeof(rec));
+		off += sizeof(rec);
+
+		pml_timer_cb cb = NULL;
+		void* data = NULL;
+		if(!impl->load_timer(ud, rec.token, &cb, &data)) {
+			continue;
+		}
+
+		struct pml_timer* t = pml_timer_new(ml, NULL, cb);
+		t->data = data;
+		t->clock_id = get_heap_id(ml, rec.clock);
+		t->lazy = rec.flags & snapshot_timer_lazy;
+		t->time = rec.time;
+		if(!(rec.flags & snapshot_timer_enabled)) {
+			continue;
+		}
+
+		t->enabled = true;
+		t->queue_time = t->time;
+		struct timer_heap* h = timer_heap(t);
+		heap_reserve(ml, h);
+		heap_set(h, h->size++, t);
+	}
+
+	for(unsigned i = 0u; i < ml->timer.n_heaps; ++i) {
+		struct timer_heap* h = &ml->timer.heaps[i];
+		for(unsigned j = h->size / 2; j-- > 0;) {
+			heap_down(h, j);
+		}
+	}
+
+	return 0;
+}
+
+// pml_watch
+#ifdef __linux__
+enum {
+	watch_buf_size = 64 * 1024,
+};
+
+static struct pml_watch** watch_bucket(struct pml* ml, int wd) {
+	// multiplicative hash, wds are usually just increasing integers
+	uint32_t h = (uint32_t) wd * 2654435761u;
+	return &ml->watch.buckets[h & (ml->watch.n_buckets - 1)];
+}
+
+static void watch_rehash(struct pml* ml) {
+	unsigned old_n = ml->watch.n_buckets;
+	struct pml_watch** old = ml->watch.buckets;
+
+	ml->watch.n_buckets = old_n ? 2 * old_n : 16;
+	ml->watch.buckets = calloc(ml->watch.n_buckets, sizeof(*old));
+	for(unsigned i = 0u; i < old_n; ++i) {
+		for(struct pml_watch* w = old[i]; w;) {
+			struct pml_watch* n = w->bucket_next;
+			struct pml_watch** b = watch_bucket(ml, w->wd);
+			w->bucket_next = *b;
+			*b = w;
+			w = n;
+		}
+	}
+
+	free(old);
+}
+
+// Removes the watch from its hash bucket.
+// Returns whether there are other watches with the same wd left.
+static bool watch_unlink_bucket(struct pml_watch* w) {
+	struct pml* ml = w->pml;
+	bool shared = false;
+	struct pml_watch** it = watch_bucket(ml, w->wd);
+	while(*it) {
+		if(*it == w) {
+			*it = w->bucket_next;
+		} else {
+			shared |= ((*it)->wd == w->wd);
+			it = &(*it)->bucket_next;
+		}
+	}
+
+	--ml->watch.n_watches;
+	w->bucket_next = NULL;
+	return shared;
+}
+
+static bool watch_matches(struct pml_watch* w, const struct inotify_event* ev) {
+	if(ev->mask & IN_Q_OVERFLOW) {
+		return true;
+	}
+
+	unsigned always = IN_IGNORED | IN_UNMOUNT;
+	return w->wd == ev->wd && (ev->mask & (w->mask | always));
+}
+
+static void watch_io_cb(struct pml_io* io, unsigned revents) {
+	struct pml* ml = pml_io_get_data(io);
+	++ml->watch.dispatching;
+	while(true) {
+		// Dispatch the current event. Like with the mainloop dispatch
+		// functions, we always store the next watch before calling
+		// the callback, nested calls of this function will continue
+		// where we left off.
+		struct pml_watch* w;
+		while((w = ml->watch.next)) {
+			const struct inotify_event* ev = ml->watch.event;
+			ml->watch.next = ml->watch.next_all ? w->next : w->bucket_next;
+			if(!watch_matches(w, ev)) {
+				continue;
+			}
+
+			if(ev->mask & IN_IGNORED) {
+				// kernel already removed the watch
+				watch_unlink_bucket(w);
+				w->wd = -1;
+			}
+
+			const char* name = ev->len ? ev->name : NULL;
+			struct sample_slot slot = sample_enter(pml_sample_watch, w,
+				(generic_fn) w->cb, ml->dispatch_depth);
+			w->cb(w, ev->mask & (w->mask | IN_IGNORED | IN_Q_OVERFLOW |
+				IN_UNMOUNT), ev->cookie, name);
+			sample_leave(slot);
+		}
+
+		if(ml->watch.buf_off < ml->watch.buf_size) {
+			const struct inotify_event* ev = (const struct inotify_event*)
+				&ml->watch.buf[ml->watch.buf_off];
+			ml->watch.buf_off += sizeof(*ev) + ev->len;
+			ml->watch.event = ev;
+
+			// IN_IGNORED unlinks watches from the bucket during iteration
+			ml->watch.next_all = (ev->mask & (IN_Q_OVERFLOW | IN_IGNORED));
+			ml->watch.next = ml->watch.next_all ?
+				ml->watch.first : *watch_bucket(ml, ev->wd);
+			continue;
+		}
+
+		ssize_t size = read(ml->watch.fd, ml->watch.buf, watch_buf_size);
+		if(size <= 0) {
+			break;
+		}
+
+		ml->watch.buf_off = 0u;
+		ml->watch.buf_size = (unsigned) size;
+	}
+
+	// rehash deferred by watches created from callbacks
+	if(--ml->watch.dispatching == 0) {
+		while(ml->watch.n_watches > ml->watch.n_buckets) {
+			watch_rehash(ml);
+		}
+	}
+}
+
+struct pml_watch* pml_watch_new(struct pml* ml, const char* path,
+		unsigned mask, pml_watch_cb cb) {
+	assert(ml);
+	assert(path);
+	assert(cb);
+
+	if(!ml->watch.io) {
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if(fd < 0) {
+			return NULL;
+		}
+
+		ml->watch.fd = fd;
+		ml->watch.buf = malloc(watch_buf_size);
+		ml->watch.io = pml_io_new(ml, fd, POLLIN, watch_io_cb);
+		pml_io_set_data(ml->watch.io, ml);
+	}
+
+	// IN_MASK_ADD: don't override the mask of other watches for the
+	// same inode, we filter events per watch anyways
+	int wd = inotify_add_watch(ml->watch.fd, path, mask | IN_MASK_ADD);
+	if(wd < 0) {
+		return NULL;
+	}
+
+	struct pml_watch* w = calloc(1, sizeof(*w));
+	w->pml = ml;
+	w->cb = cb;
+	w->wd = wd;
+	w->mask = mask;
+
+	// the chains just get longer until dispatching finishes
+	if(!ml->watch.n_buckets || (!ml->watch.dispatching &&
+			ml->watch.n_watches >= ml->watch.n_buckets)) {
+		watch_rehash(ml);
+	}
+
+	struct pml_watch** b = watch_bucket(ml, wd);
+	w->bucket_next = *b;
+	*b = w;
+	++ml->watch.n_watches;
+
+	if(!ml->watch.first) {
+		ml->watch.first = w;
+	} else {
+		ml->watch.last->next = w;
+		w->prev = ml->watch.last;
+	}
+	ml->watch.last = w;
+
+	return w;
+}
+
+void pml_watch_set_data(struct pml_watch* w, void* data) {
+	assert(w);
+	w->data = data;
+}
+
+void* pml_watch_get_data(struct pml_watch* w) {
+	assert(w);
+	return w->data;
+}
+
+void pml_watch_destroy(struct pml_watch* w) {
+	if(!w) {
+		return;
+	}
+
+	struct pml* ml = w->pml;
+	assert(ml);
+
+	if(ml->watch.next == w) {
+		ml->watch.next = ml->watch.next_all ? w->next : w->bucket_next;
+	}
+
+	if(w->wd >= 0 && !watch_unlink_bucket(w)) {
+		inotify_rm_watch(ml->watch.fd, w->wd);
+	}
+
+	if(w->next) w->next->prev = w->prev;
+	if(w->prev) w->prev->next = w->next;
+	if(w == ml->watch.first) ml->watch.first = w->next;
+	if(w == ml->watch.last) ml->watch.last = w->prev;
+	free(w);
+}
+
+unsigned pml_watch_get_mask(struct pml_watch* w) {
+	assert(w);
+	return w->mask;
+}
+
+pml_watch_cb pml_watch_get_cb(struct pml_watch* w) {
+	assert(w);
+	return w->cb;
+}
+
+struct pml* pml_watch_get_pml(struct pml_watch* w) {
+	assert(w);
+	assert(w->pml);
+	return w->pml;
+}
+#endif // __linux__
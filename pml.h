@@ -33,6 +33,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
 #ifdef __cplusplus
@@ -45,9 +47,13 @@ struct pollfd; // <poll.h>
 // Opaque structure holding all mainloop state.
 struct pml;
 struct pml_io;
+struct pml_io_group;
 struct pml_timer;
+struct pml_timer_group;
 struct pml_defer;
 struct pml_custom;
+struct pml_hook;
+struct pml_watch;
 
 // Creates a new, empty mainloop.
 // Must be destroyed using pml_destroy.
@@ -102,6 +108,212 @@ unsigned pml_query(struct pml*, struct pollfd* fds,
 // pml_dispatch must be called to consider the iteration finished.
 int pml_poll(struct pml*, int timeout);
 
+// Statistics of the mainloop.
+// The counters are only updated by the thread running the mainloop and
+// published at the end of every pml_dispatch. pml_stats_read may be
+// called from any thread without external synchronization (as the only
+// exception to the multithreading rules below) and returns a consistent
+// snapshot of the last published values.
+struct pml_stats {
+	uint64_t iterations; // finished pml_dispatch calls
+	uint64_t polls; // pml_poll calls that actually polled
+	uint64_t poll_ready; // sum of the number of ready fds returned by poll
+	uint64_t io_callbacks;
+	uint64_t timer_callbacks;
+	uint64_t defer_callbacks;
+	uint64_t custom_dispatches;
+	uint64_t fds_rebuilds; // rebuilds of the internal pollfd array
+	uint64_t fds_reallocs; // reallocations of the internal pollfd array
+	uint64_t task_callbacks;
+	uint64_t close_calls; // close syscalls from pml_io_destroy_close
+};
+
+void pml_stats_read(struct pml*, struct pml_stats*);
+
+// Busy polling, for lowest latency at the cost of cpu time.
+// When enabled, pml_poll (and therefore pml_iterate) first polls without
+// timeout for up to budget_us microseconds and only then blocks.
+// Spinning is automatically skipped while the average time between
+// arriving events is more than twice the budget, since events are
+// unlikely to arrive while spinning then.
+// 0 disables busy polling, which is the default.
+void pml_set_busy_poll(struct pml*, unsigned budget_us);
+
+struct pml_busy_poll_stats {
+	uint64_t spins; // polls that returned events while spinning
+	uint64_t blocks; // polls that had to block after spinning
+	uint64_t skipped; // polls that blocked without spinning
+};
+
+void pml_get_busy_poll_stats(struct pml*, struct pml_busy_poll_stats*);
+
+// Overload protection. The lag of the mainloop is measured as how late
+// the most overdue timer is when timers are dispatched (an internal
+// timer makes sure there is a measurement at least every `high` while
+// the mainloop is busy; it doesn't wake up an otherwise idle mainloop).
+// When the lag reaches high, the mainloop starts shedding load: sheddable
+// io sources (see pml_io_set_sheddable) aren't polled anymore, until the
+// lag drops to low again. Changes of the state are reported to the
+// optional callback from pml_prepare.
+// Pass NULL for high and low to disable the monitor, the default.
+typedef void (*pml_lag_cb)(struct pml*, bool shedding, void* data);
+void pml_set_lag_monitor(struct pml*, const struct timespec* high,
+	const struct timespec* low, pml_lag_cb, void* data);
+bool pml_is_shedding(struct pml*);
+
+// Realtime mode, e.g. for audio threads.
+// Preallocates the internal arrays used while iterating to the given
+// capacities, touches and locks them (together with the mainloop itself)
+// into memory using mlock. While enabled, iterating never allocates: when
+// one of the capacities turns out to be too small, the program is aborted
+// with an error message instead. Creating sources, adding sources
+// to groups and changing the clock of timers may still allocate.
+// Unless the capacities are 0, at least CLOCK_REALTIME and CLOCK_MONOTONIC
+// timers can be used without allocation.
+// - max_fds: number of pollfds, i.e. io sources plus fds of custom sources.
+//   On linux, also the number of io sources that can be cold at the same
+//   time (see pml_set_io_tiering), further idle sources stay in the poll set.
+// - max_timers: enabled timers per clock
+// - max_tasks: tasks scheduled per iteration, see pml_schedule
+// - priority: if not 0, switches the calling thread to SCHED_FIFO with this
+//   priority.
+// Returns 0 on success or a negative errno value when locking the memory
+// or changing the scheduling failed; realtime mode is enabled anyways.
+// Pass NULL to disable realtime mode (the default). Since the mainloop
+// might run on a different thread, the scheduling isn't reset then.
+struct pml_realtime {
+	unsigned max_fds;
+	unsigned max_timers;
+	unsigned max_tasks;
+	int priority;
+};
+
+int pml_set_realtime(struct pml*, const struct pml_realtime*);
+
+// Measured in realtime mode, over all iterations since it was enabled.
+// The time of an iteration is the time spent in prepare and dispatch,
+// i.e. without the time spent waiting in poll.
+struct pml_realtime_stats {
+	uint64_t iterations;
+	uint64_t last_iteration_ns;
+	uint64_t max_iteration_ns;
+};
+
+void pml_get_realtime_stats(struct pml*, struct pml_realtime_stats*);
+
+// Errors detected by the mainloop (e.g. a failing poll) are formatted into
+// a fixed-size lock-free ring buffer instead of being written out
+// directly, so that a slow log destination never blocks iterating.
+// Messages are dropped when the ring is full; the number of dropped
+// messages is reported with the next drain.
+// Nothing is written out on the mainloop thread by default: the ring is
+// drained by pml_log_drain, which may be called from one other thread
+// (e.g. a background logging thread) at a time. Alternatively,
+// pml_set_log_cb opts into draining the ring on the mainloop thread at
+// the end of the outermost pml_dispatch, with the given callback. Pass
+// NULL to disable that again.
+typedef void (*pml_log_cb)(struct pml*, const char* msg, void* data);
+void pml_set_log_cb(struct pml*, pml_log_cb, void* data);
+// Calls the given callback for all queued messages.
+// Returns the number of messages drained.
+unsigned pml_log_drain(struct pml*, pml_log_cb, void* data);
+
+// Profiling with hardware performance counters (linux only, using
+// perf_event_open). When enabled, the counters of the calling thread
+// are read at the start and end of the outermost pml_prepare, pml_poll and
+// pml_dispatch and between the dispatch phases of the different source
+// types; the deltas are accumulated per phase. Reading the counters
+// costs a syscall each time, so this is meant for measurements and not
+// for regular operation.
+// Returns 0 on success, or a negative errno value if no counter could be
+// opened (e.g. due to perf_event_paranoid or missing hardware support,
+// as in many virtual machines). Counters that aren't supported stay 0.
+// Enabling resets the counters. Disabled by default.
+enum pml_perf_phase {
+	pml_perf_prepare,
+	pml_perf_poll,
+	pml_perf_dispatch, // all of dispatch, including the phases below
+	pml_perf_task,
+	pml_perf_defer,
+	pml_perf_timer,
+	pml_perf_io,
+	pml_perf_custom,
+	pml_perf_phase_count,
+};
+
+struct pml_perf_counters {
+	uint64_t calls;
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t cache_misses;
+	uint64_t branch_misses;
+};
+
+int pml_set_perf(struct pml*, bool enable);
+void pml_get_perf(struct pml*,
+	struct pml_perf_counters counters[pml_perf_phase_count]);
+
+// Sampling profiler. Every mainloop publishes the callback it is
+// currently dispatching into a thread-local slot, which costs just a few
+// stores per callback. While the sampler is running, SIGPROF (via
+// setitimer with ITIMER_PROF) interrupts the process hz times per
+// second of consumed cpu time (0 for the default of 100) and the signal
+// handler aggregates the slot of the interrupted thread into a fixed-size
+// table. Since SIGPROF is process-wide, there is only one sampler for all
+// mainloops of the process. The previous SIGPROF handler and timer
+// are restored by pml_sampler_stop.
+// Returns 0 on success or a negative errno value, -EBUSY if the
+// sampler is already running.
+int pml_sampler_start(unsigned hz);
+void pml_sampler_stop(void);
+
+enum pml_sample_type {
+	pml_sample_task,
+	pml_sample_defer,
+	pml_sample_timer,
+	pml_sample_timer_group,
+	pml_sample_io,
+	pml_sample_io_group,
+	pml_sample_custom, // cb is the dispatch function of the impl
+	pml_sample_watch,
+	pml_sample_hook, // prepare and check hooks
+};
+
+struct pml_sample {
+	enum pml_sample_type type;
+	void (*cb)(void); // the callback, cast to a generic function pointer
+	void* source; // the source (or task arg) of the latest sample
+	uint64_t samples;
+	uint64_t nested; // samples in re-entrant dispatches
+};
+
+struct pml_sampler_stats {
+	uint64_t samples; // all samples
+	uint64_t idle; // samples outside of mainloop callbacks
+	uint64_t dropped; // samples not recorded since the table was full
+};
+
+// Writes the (up to) n callbacks with the most samples since the sampler
+// was started into samples, in descending order. Returns the number of
+// written entries. stats may be NULL. Can be called while the sampler
+// is running, from any thread.
+unsigned pml_sampler_report(struct pml_sample* samples, unsigned n,
+	struct pml_sampler_stats* stats);
+
+#ifdef __linux__
+// Hot/cold tiering of io sources, only available on linux.
+// When enabled, io sources whose callback wasn't called for cold_after
+// iterations are moved into an internal epoll fd that occupies a single
+// pollfd of the mainloop (also in the fds returned by pml_query). They are
+// moved back into the poll set as soon as they become ready. This keeps
+// the cost of polling low when most io sources are idle.
+// Sources with fds not supported by epoll (e.g. regular files) always
+// stay in the poll set.
+// 0 disables tiering, which is the default, and moves all cold io
+// sources back into the poll set.
+void pml_set_io_tiering(struct pml*, unsigned cold_after);
+#endif
+
 // Dispatches all ready callbacks.
 // Must be called after pml_poll, before starting a new iteration.
 // - fds: the pollfd values from pml_query, now filled with the
@@ -123,6 +335,7 @@ void pml_for_each_io(struct pml*, void (*)(struct pml_io*));
 void pml_for_each_timer(struct pml*, void (*)(struct pml_timer*));
 void pml_for_each_defer(struct pml*, void (*)(struct pml_defer*));
 void pml_for_each_custom(struct pml*, void (*)(struct pml_custom*));
+void pml_for_each_hook(struct pml*, void (*)(struct pml_hook*));
 
 
 // pml_io represents an event source for a single fd.
@@ -136,11 +349,74 @@ void pml_io_set_data(struct pml_io*, void*);
 void* pml_io_get_data(struct pml_io*);
 int pml_io_get_fd(struct pml_io*);
 void pml_io_destroy(struct pml_io*);
+// Destroys the io and closes its fd. When called while dispatching,
+// closing is deferred until the outermost pml_dispatch returns: all fds
+// queued this way are then closed at once, contiguous ranges of fds
+// with a single close_range where available. The fd therefore can't be
+// re-used by a new fd before dispatching finishes.
+void pml_io_destroy_close(struct pml_io*);
 void pml_io_set_events(struct pml_io*, unsigned events);
 unsigned pml_io_get_events(struct pml_io*);
 pml_io_cb pml_io_get_cb(struct pml_io*);
+// Changes the callback of the io source. Must not be NULL.
+void pml_io_set_cb(struct pml_io*, pml_io_cb);
 struct pml* pml_io_get_pml(struct pml_io*);
 
+// Passed as revents to the io callback when the io's deadline expired.
+// Never combined with other flags.
+enum {
+	pml_io_timeout = 0x40000000,
+};
+
+// Sets a deadline for the io, relative to now, using CLOCK_MONOTONIC.
+// When it expires before being reset or disabled, the io callback is called
+// with pml_io_timeout. The deadline is disabled afterwards.
+// Useful for idle or read timeouts, without the need for a separate
+// pml_timer per io. Resetting it is cheap, it works like a lazy timer
+// (see pml_timer_set_lazy): moving it back is O(1) and while dispatching,
+// it doesn't query the clock but is relative to the start of the
+// dispatch phase. Outside of dispatching, it is relative to the current
+// time. Pass NULL to disable the deadline (the default).
+void pml_io_set_deadline(struct pml_io*, const struct timespec* rel);
+
+// pml_io_group batches the ready events of many io sources into a single
+// callback. The callbacks of io sources in a group aren't called for
+// ready events (deadlines still use them), instead the group callback is
+// called once per iteration, after all other ready io sources were
+// dispatched, with the data pointers and revents of all ready members.
+// The events array is only valid until the callback returns.
+struct pml_io_event {
+	void* data;
+	unsigned revents;
+};
+
+typedef void (*pml_io_group_cb)(struct pml_io_group*,
+	const struct pml_io_event* events, unsigned count);
+
+struct pml_io_group* pml_io_group_new(struct pml*, pml_io_group_cb);
+void pml_io_group_set_data(struct pml_io_group*, void*);
+void* pml_io_group_get_data(struct pml_io_group*);
+// The group must not have any io sources anymore.
+// Can be called from the group callback.
+void pml_io_group_destroy(struct pml_io_group*);
+pml_io_group_cb pml_io_group_get_cb(struct pml_io_group*);
+struct pml* pml_io_group_get_pml(struct pml_io_group*);
+
+// Adds the io source to the given group, or removes it from its group
+// when passing NULL. The group must belong to the same mainloop.
+// Reserves space for twice the number of members, so that dispatching
+// the group doesn't allocate (see pml_set_realtime) as long as members
+// are removed and re-added at most once per iteration and the group is
+// dispatched at most once more from a nested iteration in its callback.
+void pml_io_set_group(struct pml_io*, struct pml_io_group*);
+struct pml_io_group* pml_io_get_group(struct pml_io*);
+
+// Sheddable io sources (e.g. listening sockets) are suspended while the
+// mainloop is overloaded, see pml_set_lag_monitor. Not sheddable
+// by default.
+void pml_io_set_sheddable(struct pml_io*, bool);
+bool pml_io_is_sheddable(struct pml_io*);
+
 
 // pml_timer
 typedef void (*pml_timer_cb)(struct pml_timer* e);
@@ -150,7 +426,9 @@ typedef int pml_clockid; // clockid_t requires to define _POSIX_C_SOURCE
 // The initial clock is CLOCK_REALTIME (i.e. time since epoch).
 struct pml_timer* pml_timer_new(struct pml*,
 	const struct timespec*, pml_timer_cb);
-// Enables the timer.
+// Enables the timer. Deadlines are stored as nanoseconds since the
+// epoch of the clock; times outside that range (about 292 years) are
+// clamped to its bounds, see pml_timer_get_time.
 void pml_timer_set_time(struct pml_timer*, struct timespec);
 // Enables the timer. In this case, timespec is relative, using the
 // timer's clock. Returns the return value from clock_gettime.
@@ -163,6 +441,8 @@ void pml_timer_set_data(struct pml_timer*, void*);
 void* pml_timer_get_data(struct pml_timer*);
 void pml_timer_destroy(struct pml_timer*);
 pml_timer_cb pml_timer_get_cb(struct pml_timer*);
+// Changes the callback of the timer. Must not be NULL.
+void pml_timer_set_cb(struct pml_timer*, pml_timer_cb);
 // Disables the timer no matter what time is currently set.
 void pml_timer_disable(struct pml_timer*);
 bool pml_timer_is_enabled(struct pml_timer*);
@@ -171,6 +451,67 @@ struct timespec pml_timer_get_time(struct pml_timer*);
 pml_clockid pml_timer_get_clock(struct pml_timer*);
 struct pml* pml_timer_get_pml(struct pml_timer*);
 
+// Lazy timers are optimized for being reset often, e.g. an idle timeout
+// that is moved back on every received packet:
+// - moving the time of an enabled lazy timer back or disabling it is O(1),
+//   the timer is only re-ordered when its previous time is reached.
+// - pml_timer_set_time_rel doesn't query the clock but uses the time
+//   at which the current (or last) dispatch phase started.
+//   Like this, the time might be in the past already, e.g. when a callback
+//   takes long. But it makes resetting thousands of timers per iteration
+//   cheap.
+// Timers are not lazy by default.
+void pml_timer_set_lazy(struct pml_timer*, bool lazy);
+bool pml_timer_is_lazy(struct pml_timer*);
+
+// Expired timers are dispatched in deadline order, i.e. the most overdue
+// timer first (compared over all clocks by how late they are).
+// This limits the number of timers dispatched per iteration. When more
+// timers have expired, the remaining ones are dispatched in the following
+// iterations, interleaved with fd events. 0 (the default) means no limit.
+void pml_set_timer_dispatch_limit(struct pml*, unsigned);
+
+// How the enabled timers of every clock are stored.
+// - pml_timer_storage_heap: a binary min-heap, the default.
+//   Changing a timer is O(log n).
+// - pml_timer_storage_flat: a flat array of deadlines that is scanned
+//   completely (using SIMD instructions where available) to find the
+//   next and the expired timers every iteration. Changing a timer is O(1).
+//   Usually faster for up to a few thousand timers.
+// Lazy timers behave like normal timers with flat storage.
+enum pml_timer_storage {
+	pml_timer_storage_heap,
+	pml_timer_storage_flat,
+};
+
+void pml_set_timer_storage(struct pml*, enum pml_timer_storage);
+
+// pml_timer_group batches the expirations of many timers into a single
+// callback. The callbacks of timers in a group aren't called, instead the
+// group callback is called once per iteration with the data pointers of
+// all member timers that expired, at the position of the most overdue one.
+// The data array is only valid until the callback returns. Like with
+// the timer callbacks, the expired timers are disabled at that point.
+// The dispatch limit counts every expired member: a group callback gets
+// at most as many timers as the remaining limit, the others are passed to
+// it in the following iterations.
+typedef void (*pml_timer_group_cb)(struct pml_timer_group*,
+	void** data, unsigned count);
+
+struct pml_timer_group* pml_timer_group_new(struct pml*, pml_timer_group_cb);
+void pml_timer_group_set_data(struct pml_timer_group*, void*);
+void* pml_timer_group_get_data(struct pml_timer_group*);
+// The group must not have any timers anymore.
+// Can be called from the group callback.
+void pml_timer_group_destroy(struct pml_timer_group*);
+pml_timer_group_cb pml_timer_group_get_cb(struct pml_timer_group*);
+struct pml* pml_timer_group_get_pml(struct pml_timer_group*);
+
+// Adds the timer to the given group, or removes it from its group when
+// passing NULL. The group must belong to the same mainloop.
+void pml_timer_set_group(struct pml_timer*, struct pml_timer_group*);
+struct pml_timer_group* pml_timer_get_group(struct pml_timer*);
+
 
 // pml_defer represents a single callback that is called during the
 // next iteration of the mainloop. It won't be automatically disabled
@@ -184,9 +525,28 @@ void pml_defer_set_data(struct pml_defer*, void*);
 void* pml_defer_get_data(struct pml_defer*);
 void pml_defer_destroy(struct pml_defer*);
 pml_defer_cb pml_defer_get_cb(struct pml_defer*);
+// Changes the callback of the defer source. Must not be NULL.
+void pml_defer_set_cb(struct pml_defer*, pml_defer_cb);
 struct pml* pml_defer_get_pml(struct pml_defer*);
 
 
+// One-shot tasks. Cheaper than creating and destroying a pml_defer for
+// every one-shot callback: tasks are stored by value in a queue owned by
+// the mainloop (that only grows), there is no handle and nothing to
+// destroy. When no tasks are scheduled, they have no cost per iteration.
+typedef void (*pml_task_fn)(void* arg);
+
+// Schedules fn(arg) to be called once during the next dispatch, before
+// all other callbacks. The tasks of one iteration are called in
+// earliest-deadline-first order, tasks with the same deadline in the order
+// they were scheduled. The deadline is only used for ordering, all
+// scheduled tasks are called in the next iteration; polling won't block
+// while tasks are scheduled. Tasks scheduled from a task are called
+// in the following iteration.
+void pml_schedule(struct pml*, pml_task_fn, void* arg,
+	struct timespec deadline);
+
+
 // pml_custom
 // Useful to integrate other mainloops, e.g. glib.
 // Notice how this interface is basically a mirror of the mainloop
@@ -221,6 +581,14 @@ struct pml_custom_impl {
 	// actually have data or that the timeout expired, this has to
 	// be checked first.
 	void (*dispatch)(struct pml_custom*, struct pollfd*, unsigned n_fds);
+	// Called with the same arguments as dispatch, before dispatch.
+	// Should return whether anything is ready, i.e. whether dispatch
+	// has to be called. When it returns false, dispatch is skipped for
+	// this iteration. Allows to skip the function call and the pollfd
+	// scan in dispatch for idle sources.
+	// Must not access the mainloop or change any event sources.
+	// Optional, can be NULL. In that case, dispatch is always called.
+	bool (*check)(struct pml_custom*, struct pollfd*, unsigned n_fds);
 };
 
 struct pml_custom* pml_custom_new(struct pml*, const struct pml_custom_impl*);
@@ -230,6 +598,103 @@ void pml_custom_destroy(struct pml_custom*);
 const struct pml_custom_impl* pml_custom_get_impl(struct pml_custom*);
 struct pml* pml_custom_get_pml(struct pml_custom*);
 
+
+// pml_hook
+// Hooks are called once per mainloop iteration, independent from
+// any events. Useful to batch work, e.g. to flush all writes queued
+// by io callbacks once before the mainloop blocks.
+enum pml_hook_type {
+	// Called at the start of pml_prepare, before timeouts are computed.
+	// So they can still enable defer sources or timers, which will
+	// be considered for the iteration.
+	pml_hook_prepare,
+	// Called in pml_poll, right after polling.
+	pml_hook_check,
+};
+
+// Hooks may change or destroy any sources (including other hooks)
+// but must not start a mainloop iteration.
+typedef void (*pml_hook_cb)(struct pml_hook*);
+
+struct pml_hook* pml_hook_new(struct pml*, enum pml_hook_type, pml_hook_cb);
+void pml_hook_set_data(struct pml_hook*, void*);
+void* pml_hook_get_data(struct pml_hook*);
+void pml_hook_destroy(struct pml_hook*);
+enum pml_hook_type pml_hook_get_type(struct pml_hook*);
+pml_hook_cb pml_hook_get_cb(struct pml_hook*);
+struct pml* pml_hook_get_pml(struct pml_hook*);
+
+
+// Snapshots
+// Allow to save the io and timer sources of a mainloop and restore them
+// in a fresh mainloop, e.g. in a new process during a hot upgrade.
+// The enabled state and time of timers and the deadlines of io
+// sources (see pml_io_set_deadline) are restored as well.
+// Callbacks and data can't be serialized, the application identifies
+// sources by tokens instead.
+struct pml_snapshot_impl {
+	// Called by pml_snapshot for every io/timer. Should write the token
+	// for the source and return true, or return false if the source
+	// should not be saved (e.g. because it can't be restored).
+	bool (*save_io)(void* ud, struct pml_io*, uint64_t* token);
+	bool (*save_timer)(void* ud, struct pml_timer*, uint64_t* token);
+	// Called by pml_restore for every saved io/timer. Must write
+	// the callback (and can write the data) for the source that is
+	// restored and return true, or return false to skip the source.
+	bool (*load_io)(void* ud, uint64_t token, int fd,
+		pml_io_cb* cb, void** data);
+	bool (*load_timer)(void* ud, uint64_t token,
+		pml_timer_cb* cb, void** data);
+};
+
+// Writes the snapshot into buf if size is large enough.
+// Always returns the size required for the snapshot, so it can be called
+// with a NULL buf first. Only the save functions of impl are used.
+// - fds: optional, when buf is large enough the fds of the saved io
+//   sources are written to it (one per io, in the order they are expected
+//   by pml_restore). Otherwise not touched. This is the order in
+//   which to transmit the fds to another process (e.g. via SCM_RIGHTS).
+size_t pml_snapshot(struct pml*, void* buf, size_t size, int* fds,
+	const struct pml_snapshot_impl*, void* ud);
+// Creates the sources from the given snapshot.
+// - fds: the fds of the io sources (as written by pml_snapshot, but
+//   might be different values, e.g. after being transmitted to another
+//   process). n_fds must not be smaller than the number of saved io sources.
+// Only the load functions of impl are used.
+// Returns 0 on success or a negative value if the snapshot is invalid
+// (e.g. truncated or referencing an fd index twice or beyond n_fds);
+// no sources are created then.
+int pml_restore(struct pml*, const void* buf, size_t size,
+	const int* fds, unsigned n_fds, const struct pml_snapshot_impl*, void* ud);
+
+#ifdef __linux__
+// pml_watch watches a path for filesystem events using inotify.
+// Only available on linux.
+// All watches of a mainloop share one inotify fd (and therefore
+// one pollfd), created with the first watch. Multiple watches for the
+// same path (or inode) are possible.
+// mask and the mask passed to the callback are IN_XXX flags from
+// <sys/inotify.h>. Independent from mask, the callback might additionally
+// be called with IN_IGNORED (the watch was removed by the kernel, e.g.
+// because the file was deleted; the watch won't receive any more events and
+// should be destroyed), IN_Q_OVERFLOW (events were lost; delivered to all
+// watches) or IN_UNMOUNT.
+// name is the name of the file inside a watched directory the event
+// refers to, or NULL.
+typedef void (*pml_watch_cb)(struct pml_watch*, unsigned mask,
+	unsigned cookie, const char* name);
+
+// Returns NULL on failure, errno will be set in that case.
+struct pml_watch* pml_watch_new(struct pml*, const char* path,
+	unsigned mask, pml_watch_cb);
+void pml_watch_set_data(struct pml_watch*, void*);
+void* pml_watch_get_data(struct pml_watch*);
+void pml_watch_destroy(struct pml_watch*);
+unsigned pml_watch_get_mask(struct pml_watch*);
+pml_watch_cb pml_watch_get_cb(struct pml_watch*);
+struct pml* pml_watch_get_pml(struct pml_watch*);
+#endif // __linux__
+
 #ifdef __cplusplus
 }
 #endif
@@ -252,10 +717,13 @@ struct pml* pml_custom_get_pml(struct pml_custom*);
 // ---------------
 //
 // Neither mainloop nor event sources have any internal synchronization
-// mechanisms. They also won't start any helper threads.
+// mechanisms (except for pml_stats_read). They also won't start any
+// helper threads (pml_fs does, as its own module).
 // That means, applications can (and have to) use external synchronization
 // to acess the mainloop and its sources, when needed.
-// Since the mainloop doesn't use any global state, it is also possible
+// Since the mainloop doesn't use any global state (except for the
+// process-wide sampler, see pml_sampler_start, which is only touched by
+// pml_sampler_* and the SIGPROF handler), it is also possible
 // to just multiple mainloops, e.g. one per thread.
 //
 // Re-entrance:
@@ -307,6 +775,8 @@ struct pml* pml_custom_get_pml(struct pml_custom*);
 // - after prepare being called, there will be exactly one call of
 //   dispatch before prepare might be called again. This call will not
 //   happen if source or mainloop is destroyed in between though.
+//   It's also skipped if the source implements check and check returned
+//   false. Check will be called at most once per prepare call.
 // - calls to query will only happen between a call to prepare and dispatch
 // The conditions holds true even when the mainloop is using in re-entrant
 // scenarios. Dispatch counts as called as soon as the callback starts.
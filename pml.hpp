@@ -0,0 +1,190 @@
+// Copyright 2019 Jan Kelling
+//
+// pml is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// Header-only C++17 wrapper for pml.
+// All types are move-only RAII owners of the respective pml object.
+// Callbacks are bound at compile time: `io.on<&Conn::readable>(this)`
+// instantiates a plain C trampoline for exactly that member function, so
+// dispatching it costs one indirect call (the one pml does anyway) plus
+// a direct (usually inlined) call. There is no std::function,
+// allocation or virtual dispatch involved.
+// The wrapper types live in namespace pmlpp since a namespace can't
+// share its name with the C `struct pml`.
+
+#pragma once
+
+#include "pml.h"
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <ctime>
+
+namespace pmlpp {
+namespace detail {
+
+template<typename T, void (*Destroy)(T*)>
+class handle {
+public:
+	handle() = default;
+	explicit handle(T* h) : h_(h) {}
+	~handle() { Destroy(h_); }
+
+	handle(handle&& rhs) noexcept : h_(std::exchange(rhs.h_, nullptr)) {}
+	// Destroys the current object right away, so that e.g. the callback
+	// of a replaced source can't be called anymore.
+	handle& operator=(handle&& rhs) noexcept {
+		if(this != &rhs) {
+			Destroy(h_);
+			h_ = std::exchange(rhs.h_, nullptr);
+		}
+		return *this;
+	}
+
+	handle(const handle&) = delete;
+	handle& operator=(const handle&) = delete;
+
+	T* get() const { return h_; }
+	T* release() { return std::exchange(h_, nullptr); }
+	explicit operator bool() const { return h_; }
+
+private:
+	T* h_ {};
+};
+
+inline struct timespec to_timespec(std::chrono::nanoseconds ns) {
+	struct timespec ts {};
+	ts.tv_sec = std::time_t(ns.count() / 1000000000);
+	ts.tv_nsec = long(ns.count() % 1000000000);
+	return ts;
+}
+
+} // namespace detail
+
+class loop : public detail::handle<struct pml, pml_destroy> {
+public:
+	loop() : handle(pml_new()) {}
+	explicit loop(struct pml* ml) : handle(ml) {}
+
+	int iterate(bool block = true) { return pml_iterate(get(), block); }
+	void prepare() { pml_prepare(get()); }
+	int poll(int timeout) { return pml_poll(get(), timeout); }
+	void dispatch(struct pollfd* fds, unsigned n_fds) {
+		pml_dispatch(get(), fds, n_fds);
+	}
+	unsigned query(struct pollfd* fds, unsigned n_fds, int& timeout) {
+		return pml_query(get(), fds, n_fds, &timeout);
+	}
+};
+
+class io : public detail::handle<struct pml_io, pml_io_destroy> {
+public:
+	io() = default;
+	io(loop& ml, int fd, unsigned events) :
+		handle(pml_io_new(ml.get(), fd, events, noop)) {}
+
+	// Calls F(obj, revents) when the fd is ready. F can be a member
+	// function of T or any callable with a matching signature.
+	template<auto F, typename T>
+	void on(T* obj) {
+		pml_io_set_data(get(), obj);
+		pml_io_set_cb(get(), [](struct pml_io* io, unsigned revents) {
+			std::invoke(F, static_cast<T*>(pml_io_get_data(io)), revents);
+		});
+	}
+
+	// Calls F(revents) when the fd is ready.
+	template<auto F>
+	void on() {
+		pml_io_set_cb(get(), [](struct pml_io*, unsigned revents) {
+			std::invoke(F, revents);
+		});
+	}
+
+	int fd() const { return pml_io_get_fd(get()); }
+	unsigned events() const { return pml_io_get_events(get()); }
+	void events(unsigned events) { pml_io_set_events(get(), events); }
+
+	// Callbacks receive pml_io_timeout when the deadline expires.
+	void deadline(std::chrono::nanoseconds rel) {
+		auto ts = detail::to_timespec(rel);
+		pml_io_set_deadline(get(), &ts);
+	}
+	void clear_deadline() { pml_io_set_deadline(get(), nullptr); }
+
+private:
+	static void noop(struct pml_io*, unsigned) {}
+};
+
+class timer : public detail::handle<struct pml_timer, pml_timer_destroy> {
+public:
+	timer() = default;
+	explicit timer(loop& ml) : handle(pml_timer_new(ml.get(), nullptr, noop)) {}
+	timer(loop& ml, const struct timespec& time) :
+		handle(pml_timer_new(ml.get(), &time, noop)) {}
+
+	// Calls F(obj) when the timer expires.
+	template<auto F, typename T>
+	void on(T* obj) {
+		pml_timer_set_data(get(), obj);
+		pml_timer_set_cb(get(), [](struct pml_timer* t) {
+			std::invoke(F, static_cast<T*>(pml_timer_get_data(t)));
+		});
+	}
+
+	// Calls F() when the timer expires.
+	template<auto F>
+	void on() {
+		pml_timer_set_cb(get(), [](struct pml_timer*) { std::invoke(F); });
+	}
+
+	void set_time(const struct timespec& time) {
+		pml_timer_set_time(get(), time);
+	}
+	int set_time_rel(const struct timespec& time) {
+		return pml_timer_set_time_rel(get(), time);
+	}
+	int set_time_rel(std::chrono::nanoseconds time) {
+		return pml_timer_set_time_rel(get(), detail::to_timespec(time));
+	}
+
+	void clock(pml_clockid clock) { pml_timer_set_clock(get(), clock); }
+	pml_clockid clock() const { return pml_timer_get_clock(get()); }
+	struct timespec time() const { return pml_timer_get_time(get()); }
+	void disable() { pml_timer_disable(get()); }
+	bool enabled() const { return pml_timer_is_enabled(get()); }
+
+private:
+	static void noop(struct pml_timer*) {}
+};
+
+class defer : public detail::handle<struct pml_defer, pml_defer_destroy> {
+public:
+	defer() = default;
+	explicit defer(loop& ml) : handle(pml_defer_new(ml.get(), noop)) {}
+
+	// Calls F(obj) every iteration while enabled.
+	template<auto F, typename T>
+	void on(T* obj) {
+		pml_defer_set_data(get(), obj);
+		pml_defer_set_cb(get(), [](struct pml_defer* d) {
+			std::invoke(F, static_cast<T*>(pml_defer_get_data(d)));
+		});
+	}
+
+	// Calls F() every iteration while enabled.
+	template<auto F>
+	void on() {
+		pml_defer_set_cb(get(), [](struct pml_defer*) { std::invoke(F); });
+	}
+
+	void enable(bool enable = true) { pml_defer_enable(get(), enable); }
+
+private:
+	static void noop(struct pml_defer*) {}
+};
+
+} // namespace pmlpp
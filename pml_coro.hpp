@@ -0,0 +1,238 @@
+// Copyright 2019 Jan Kelling
+//
+// pml is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// C++20 coroutine support on top of pml.hpp.
+// Awaitables resume the suspended coroutine directly from the pml_io or
+// pml_timer callback, i.e. from inside pml_dispatch, without any
+// intermediate queue.
+//
+// ```
+// pmlpp::task reader(pmlpp::frame_pool&, pmlpp::loop& ml, pmlpp::io& io) {
+// 	while(true) {
+// 		unsigned revents = co_await pmlpp::readable(io);
+// 		...
+// 		co_await pmlpp::sleep_for(ml, 5ms);
+// 	}
+// }
+// ```
+//
+// pmlpp::task is a detached, eagerly started coroutine. Its frame is
+// destroyed when the coroutine finishes. When the first parameter
+// (or the second one for member functions) is a frame_pool, the frame
+// is allocated from it. Keep one frame_pool per loop, it has no
+// internal synchronization. The pool must outlive all coroutines
+// allocated from it.
+// GCC 12 falsely warns with -Wmismatched-new-delete for coroutines
+// allocated from a frame_pool (GCC bug 109224).
+//
+// An io that is awaited is owned by the awaiting coroutine: the awaitable
+// replaces its callback and data and sets its events to 0 before resuming.
+// Until it is awaited again, the io ignores its events. Note that an fd
+// with an error or hangup is still reported by poll then, so such an io
+// should be destroyed instead of being left alone.
+// Destroying the loop while coroutines are suspended leaks their frames.
+
+#pragma once
+
+#include "pml.hpp"
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <poll.h>
+
+namespace pmlpp {
+
+// Caches coroutine frames in size-class free lists so that starting
+// a coroutine doesn't hit the global allocator in the steady state.
+class frame_pool {
+public:
+	frame_pool() = default;
+	~frame_pool() {
+		for(auto& head : free_) {
+			while(head) {
+				::operator delete(std::exchange(head, head->next));
+			}
+		}
+	}
+
+	frame_pool(const frame_pool&) = delete;
+	frame_pool& operator=(const frame_pool&) = delete;
+
+	void* alloc(std::size_t size) { return alloc(this, size); }
+
+	// When pool is null, just uses the global allocator.
+	static void* alloc(frame_pool* pool, std::size_t size) {
+		auto total = size + sizeof(header);
+		auto bucket = (total - 1) / granularity;
+		void* block;
+		if(pool && bucket < n_buckets && pool->free_[bucket]) {
+			block = std::exchange(pool->free_[bucket],
+				pool->free_[bucket]->next);
+		} else if(bucket < n_buckets) {
+			block = ::operator new((bucket + 1) * granularity);
+		} else {
+			block = ::operator new(total);
+		}
+
+		return ::new(block) header{pool, bucket} + 1;
+	}
+
+	static void free(void* ptr) {
+		auto h = static_cast<header*>(ptr) - 1;
+		auto [pool, bucket] = *h;
+		if(pool && bucket < n_buckets) {
+			pool->free_[bucket] = ::new(h) node{pool->free_[bucket]};
+		} else {
+			::operator delete(h);
+		}
+	}
+
+private:
+	struct node {
+		node* next;
+	};
+
+	struct alignas(std::max_align_t) header {
+		frame_pool* pool;
+		std::size_t bucket;
+	};
+
+	static constexpr std::size_t granularity = 64;
+	static constexpr std::size_t n_buckets = 32;
+
+	node* free_[n_buckets] {};
+};
+
+class task {
+public:
+	struct promise_type {
+		task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+
+		template<typename... Args>
+		static void* operator new(std::size_t size, frame_pool& pool,
+				Args&...) {
+			return pool.alloc(size);
+		}
+
+		template<typename C, typename... Args>
+		static void* operator new(std::size_t size, C&, frame_pool& pool,
+				Args&...) {
+			return pool.alloc(size);
+		}
+
+		static void* operator new(std::size_t size) {
+			return frame_pool::alloc(nullptr, size);
+		}
+
+		static void operator delete(void* ptr) {
+			frame_pool::free(ptr);
+		}
+	};
+};
+
+class io_awaitable {
+public:
+	io_awaitable(io& io, unsigned events) : io_(io.get()), events_(events) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		handle_ = h;
+		pml_io_set_data(io_, this);
+		pml_io_set_cb(io_, cb);
+		pml_io_set_events(io_, events_);
+	}
+	unsigned await_resume() const noexcept { return revents_; }
+
+private:
+	static void cb(struct pml_io* io, unsigned revents) {
+		auto self = static_cast<io_awaitable*>(pml_io_get_data(io));
+		self->revents_ = revents;
+
+		// poll reports errors and hangups even for events 0, those
+		// must not resume the coroutine at a different suspension point
+		// or touch this awaitable after it's gone
+		pml_io_set_events(io, 0);
+		pml_io_set_data(io, nullptr);
+		pml_io_set_cb(io, idle);
+		self->handle_.resume();
+	}
+
+	static void idle(struct pml_io*, unsigned) {}
+
+	struct pml_io* io_;
+	unsigned events_;
+	unsigned revents_ {};
+	std::coroutine_handle<> handle_;
+};
+
+// Suspends until the io is readable (or has an error/hangup).
+// Returns the revents.
+inline io_awaitable readable(io& io) { return {io, POLLIN}; }
+inline io_awaitable writable(io& io) { return {io, POLLOUT}; }
+
+class sleep_awaitable {
+public:
+	// Creates a temporary timer when suspending.
+	sleep_awaitable(loop& ml, std::chrono::nanoseconds dur) :
+		ml_(ml.get()), dur_(dur) {}
+	// Reuses the given timer, avoiding the allocation. Like with io,
+	// the timer's callback, data and clock are replaced.
+	sleep_awaitable(timer& t, std::chrono::nanoseconds dur) :
+		timer_(t.get()), dur_(dur) {}
+
+	~sleep_awaitable() {
+		if(ml_) {
+			pml_timer_destroy(timer_);
+		}
+	}
+
+	sleep_awaitable(const sleep_awaitable&) = delete;
+	sleep_awaitable& operator=(const sleep_awaitable&) = delete;
+
+	bool await_ready() const noexcept { return dur_.count() <= 0; }
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		handle_ = h;
+		if(ml_) {
+			timer_ = pml_timer_new(ml_, nullptr, cb);
+		} else {
+			pml_timer_set_cb(timer_, cb);
+		}
+
+		pml_timer_set_data(timer_, this);
+		pml_timer_set_clock(timer_, CLOCK_MONOTONIC);
+		pml_timer_set_time_rel(timer_, detail::to_timespec(dur_));
+	}
+	void await_resume() const noexcept {}
+
+private:
+	static void cb(struct pml_timer* t) {
+		static_cast<sleep_awaitable*>(pml_timer_get_data(t))->handle_.resume();
+	}
+
+	struct pml* ml_ {};
+	struct pml_timer* timer_ {};
+	std::chrono::nanoseconds dur_;
+	std::coroutine_handle<> handle_;
+};
+
+template<typename Rep, typename Period>
+sleep_awaitable sleep_for(loop& ml, std::chrono::duration<Rep, Period> dur) {
+	return {ml, dur};
+}
+
+template<typename Rep, typename Period>
+sleep_awaitable sleep_for(timer& t, std::chrono::duration<Rep, Period> dur) {
+	return {t, dur};
+}
+
+} // namespace pmlpp
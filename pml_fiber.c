@@ -0,0 +1,281 @@
+// Copyright 2019 Jan Kelling
+//
+// pml is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include "pml_fiber.h"
+#include "pml.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+struct pml_fiber_pool {
+	struct pml* pml;
+	size_t stack_size; // without guard page
+	size_t page_size;
+	unsigned n_alive; // fibers currently using a stack
+
+	unsigned n_cached;
+	unsigned max_cached;
+	void** cached; // base pointers (guard page) of unused stacks
+};
+
+// What a suspended fiber is waiting for. Only that source may resume it.
+enum wait {
+	wait_none,
+	wait_io,
+	wait_timer,
+};
+
+struct pml_fiber {
+	struct pml_fiber_pool* pool;
+	void* data;
+	pml_fiber_fn fn;
+	void* stack; // base pointer, including the guard page
+	bool done;
+
+	ucontext_t ctx;
+	ucontext_t caller;
+
+	// lazily created and re-used for all waits of this fiber
+	struct pml_io* io;
+	struct pml_timer* timer;
+	unsigned revents;
+	enum wait wait;
+};
+
+static _Thread_local struct pml_fiber* current;
+
+static void* alloc_stack(struct pml_fiber_pool* pool) {
+	if(pool->n_cached) {
+		return pool->cached[--pool->n_cached];
+	}
+
+	size_t size = pool->stack_size + pool->page_size;
+	void* stack = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(stack == MAP_FAILED) {
+		return NULL;
+	}
+
+	// stacks grow down on all supported platforms
+	if(mprotect(stack, pool->page_size, PROT_NONE) != 0) {
+		munmap(stack, size);
+		return NULL;
+	}
+
+	return stack;
+}
+
+static void free_stack(struct pml_fiber_pool* pool, void* stack) {
+	if(pool->n_cached < pool->max_cached) {
+		pool->cached[pool->n_cached++] = stack;
+		return;
+	}
+
+	munmap(stack, pool->stack_size + pool->page_size);
+}
+
+static void destroy_fiber(struct pml_fiber* f) {
+	pml_io_destroy(f->io);
+	pml_timer_destroy(f->timer);
+	free_stack(f->pool, f->stack);
+	--f->pool->n_alive;
+	free(f);
+}
+
+// Returns false if the fiber finished and was destroyed.
+static bool resume(struct pml_fiber* f) {
+	struct pml_fiber* prev = current;
+	current = f;
+	f->wait = wait_none;
+	swapcontext(&f->caller, &f->ctx);
+	current = prev;
+
+	if(f->done) {
+		destroy_fiber(f);
+		return false;
+	}
+
+	return true;
+}
+
+static void suspend(struct pml_fiber* f) {
+	assert(f == current);
+	swapcontext(&f->ctx, &f->caller);
+}
+
+static void entry(void) {
+	struct pml_fiber* f = current;
+	f->fn(f);
+	f->done = true;
+	// returns to f->caller via uc_link
+}
+
+static void io_cb(struct pml_io* io, unsigned revents) {
+	struct pml_fiber* f = pml_io_get_data(io);
+
+	// poll reports errors and hangups even for events 0. The fiber
+	// isn't waiting for the io, so just drop it; it is re-created by
+	// the next pml_fiber_wait_io.
+	if(f->wait != wait_io) {
+		pml_io_destroy(io);
+		f->io = NULL;
+		return;
+	}
+
+	f->revents = revents;
+	pml_io_set_events(io, 0);
+	if(f->timer) {
+		pml_timer_disable(f->timer);
+	}
+	resume(f);
+}
+
+static void timer_cb(struct pml_timer* timer) {
+	struct pml_fiber* f = pml_timer_get_data(timer);
+	if(f->wait == wait_timer) {
+		resume(f);
+	}
+}
+
+// getcontext returns twice, locals that are live across it might be
+// clobbered (-Wclobbered). Kept out of line so that pml_fiber_new
+// doesn't have any.
+#if defined(__GNUC__) || defined(__clang__)
+	#define NOINLINE __attribute__((noinline))
+#else
+	#define NOINLINE
+#endif
+
+static NOINLINE void init_context(struct pml_fiber* f) {
+	getcontext(&f->ctx);
+	f->ctx.uc_stack.ss_sp = (char*) f->stack + f->pool->page_size;
+	f->ctx.uc_stack.ss_size = f->pool->stack_size;
+	f->ctx.uc_link = &f->caller;
+	makecontext(&f->ctx, entry, 0);
+}
+
+struct pml_fiber_pool* pml_fiber_pool_new(struct pml* ml, size_t stack_size,
+		unsigned max_cached) {
+	assert(ml);
+
+	struct pml_fiber_pool* pool = calloc(1, sizeof(*pool));
+	pool->pml = ml;
+	pool->page_size = (size_t) sysconf(_SC_PAGESIZE);
+	if(!stack_size) {
+		stack_size = 64 * 1024;
+	}
+
+	pool->stack_size = (stack_size + pool->page_size - 1) &
+		~(pool->page_size - 1);
+	pool->max_cached = max_cached;
+	if(max_cached) {
+		pool->cached = calloc(max_cached, sizeof(*pool->cached));
+	}
+
+	return pool;
+}
+
+void pml_fiber_pool_destroy(struct pml_fiber_pool* pool) {
+	if(!pool) {
+		return;
+	}
+
+	assert(pool->n_alive == 0 && "Destroying pool with unfinished fibers");
+	for(unsigned i = 0u; i < pool->n_cached; ++i) {
+		munmap(pool->cached[i], pool->stack_size + pool->page_size);
+	}
+
+	free(pool->cached);
+	free(pool);
+}
+
+struct pml_fiber* pml_fiber_new(struct pml_fiber_pool* pool,
+		pml_fiber_fn fn, void* data) {
+	assert(pool);
+	assert(fn);
+
+	void* stack = alloc_stack(pool);
+	if(!stack) {
+		return NULL;
+	}
+
+	struct pml_fiber* f = calloc(1, sizeof(*f));
+	f->pool = pool;
+	f->fn = fn;
+	f->data = data;
+	f->stack = stack;
+	++pool->n_alive;
+
+	init_context(f);
+	return resume(f) ? f : NULL;
+}
+
+void* pml_fiber_get_data(struct pml_fiber* f) {
+	assert(f);
+	return f->data;
+}
+
+void pml_fiber_set_data(struct pml_fiber* f, void* data) {
+	assert(f);
+	f->data = data;
+}
+
+struct pml* pml_fiber_get_pml(struct pml_fiber* f) {
+	assert(f);
+	return f->pool->pml;
+}
+
+struct pml_fiber* pml_fiber_current(void) {
+	return current;
+}
+
+unsigned pml_fiber_wait_io(int fd, unsigned events) {
+	struct pml_fiber* f = current;
+	assert(f && "pml_fiber_wait_io called outside of a fiber");
+
+	// re-use the io for the common case of waiting on the same fd
+	if(f->io && pml_io_get_fd(f->io) != fd) {
+		pml_io_destroy(f->io);
+		f->io = NULL;
+	}
+
+	if(!f->io) {
+		f->io = pml_io_new(f->pool->pml, fd, events, io_cb);
+		pml_io_set_data(f->io, f);
+	} else {
+		pml_io_set_events(f->io, events);
+	}
+
+	f->wait = wait_io;
+	suspend(f);
+	return f->revents;
+}
+
+int pml_fiber_sleep(struct timespec rel) {
+	struct pml_fiber* f = current;
+	assert(f && "pml_fiber_sleep called outside of a fiber");
+
+	if(!f->timer) {
+		f->timer = pml_timer_new(f->pool->pml, NULL, timer_cb);
+		pml_timer_set_clock(f->timer, CLOCK_MONOTONIC);
+		pml_timer_set_data(f->timer, f);
+	}
+
+	int res = pml_timer_set_time_rel(f->timer, rel);
+	if(res != 0) {
+		return res;
+	}
+
+	f->wait = wait_timer;
+	suspend(f);
+	return 0;
+}
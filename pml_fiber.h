@@ -0,0 +1,66 @@
+// Copyright 2019 Jan Kelling
+//
+// pml is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// Stackful fibers on top of a pml mainloop.
+// Allows to run blocking-style code on the mainloop without a thread
+// per connection: inside a fiber, pml_fiber_wait_io and pml_fiber_sleep
+// suspend the fiber and return to the mainloop. The fiber is resumed
+// from the respective pml_io/pml_timer callback.
+// Only available where ucontext (swapcontext) is available.
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pml;
+struct pml_fiber;
+struct pml_fiber_pool;
+
+typedef void (*pml_fiber_fn)(struct pml_fiber*);
+
+// Pool of fiber stacks for one mainloop. Stacks are allocated using mmap,
+// with a guard page below each stack, and cached for re-use when a fiber
+// finishes.
+// - stack_size: will be rounded up to the page size. 0 for the default
+//   size of 64 KiB.
+// - max_cached: the maximum number of unused stacks to keep.
+struct pml_fiber_pool* pml_fiber_pool_new(struct pml*, size_t stack_size,
+	unsigned max_cached);
+// All fibers created from the pool must have finished.
+void pml_fiber_pool_destroy(struct pml_fiber_pool*);
+
+// Creates a new fiber and immediately starts running it until it
+// first suspends (or finishes). The fiber is destroyed automatically
+// when the given function returns.
+// Returns NULL if no stack could be allocated or if the fiber already
+// finished (and was destroyed) before first suspending.
+struct pml_fiber* pml_fiber_new(struct pml_fiber_pool*, pml_fiber_fn,
+	void* data);
+void* pml_fiber_get_data(struct pml_fiber*);
+void pml_fiber_set_data(struct pml_fiber*, void*);
+struct pml* pml_fiber_get_pml(struct pml_fiber*);
+
+// Returns the fiber running on the calling thread or NULL if the
+// calling code isn't running inside a fiber.
+struct pml_fiber* pml_fiber_current(void);
+
+// The following functions must only be called from inside a fiber.
+// Suspends the current fiber until the given fd has one of the given
+// poll events (or an error/hangup). Returns the revents.
+unsigned pml_fiber_wait_io(int fd, unsigned events);
+// Suspends the current fiber for the given time (using CLOCK_MONOTONIC).
+// Returns the return value from clock_gettime.
+int pml_fiber_sleep(struct timespec rel);
+
+#ifdef __cplusplus
+}
+#endif
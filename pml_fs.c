@@ -0,0 +1,313 @@
+// Copyright 2019 Jan Kelling
+//
+// pml is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pml_fs.h"
+#include "pml.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+enum op {
+	op_read,
+	op_write,
+	op_fsync,
+	op_openat,
+};
+
+struct pml_fs_req {
+	struct pml_fs_req* next;
+	struct pml_fs* fs;
+	enum op op;
+	int fd;
+	void* buf;
+	size_t size;
+	off_t offset;
+	const char* path;
+	int flags;
+	mode_t mode;
+	ssize_t res;
+	pml_fs_cb cb;
+	void* data;
+};
+
+struct req_list {
+	struct pml_fs_req* first;
+	struct pml_fs_req* last;
+};
+
+struct pml_fs {
+	struct pml* pml;
+	struct pml_io* io;
+	int pipe[2];
+
+	unsigned n_threads;
+	pthread_t* threads;
+
+	// only accessed from the mainloop thread
+	struct pml_fs_req* free;
+
+	// protected by mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct req_list pending;
+	struct req_list done;
+	bool signaled; // whether pipe has unread data
+	bool quit;
+};
+
+static void push(struct req_list* list, struct pml_fs_req* req) {
+	req->next = NULL;
+	if(list->last) {
+		list->last->next = req;
+	} else {
+		list->first = req;
+	}
+	list->last = req;
+}
+
+static struct pml_fs_req* pop(struct req_list* list) {
+	struct pml_fs_req* req = list->first;
+	if(req) {
+		list->first = req->next;
+		if(!list->first) {
+			list->last = NULL;
+		}
+	}
+	return req;
+}
+
+static ssize_t perform(struct pml_fs_req* req) {
+	ssize_t res = -1;
+	switch(req->op) {
+		case op_read:
+			res = pread(req->fd, req->buf, req->size, req->offset);
+			break;
+		case op_write:
+			res = pwrite(req->fd, req->buf, req->size, req->offset);
+			break;
+		case op_fsync:
+			res = fsync(req->fd);
+			break;
+		case op_openat:
+			res = openat(req->fd, req->path, req->flags, req->mode);
+			break;
+	}
+
+	return res < 0 ? -errno : res;
+}
+
+static void* worker(void* data) {
+	struct pml_fs* fs = data;
+	pthread_mutex_lock(&fs->mutex);
+	while(true) {
+		while(!fs->quit && !fs->pending.first) {
+			pthread_cond_wait(&fs->cond, &fs->mutex);
+		}
+
+		if(fs->quit) {
+			break;
+		}
+
+		struct pml_fs_req* req = pop(&fs->pending);
+		pthread_mutex_unlock(&fs->mutex);
+
+		req->res = perform(req);
+
+		pthread_mutex_lock(&fs->mutex);
+		push(&fs->done, req);
+		if(!fs->signaled) {
+			fs->signaled = true;
+			char c = 0;
+			ssize_t ret = write(fs->pipe[1], &c, 1);
+			assert(ret == 1);
+			(void) ret;
+		}
+	}
+
+	pthread_mutex_unlock(&fs->mutex);
+	return NULL;
+}
+
+static void io_cb(struct pml_io* io, unsigned revents) {
+	struct pml_fs* fs = pml_io_get_data(io);
+
+	pthread_mutex_lock(&fs->mutex);
+	char c;
+	while(read(fs->pipe[0], &c, 1) > 0);
+	fs->signaled = false;
+	struct req_list done = fs->done;
+	fs->done.first = fs->done.last = NULL;
+	pthread_mutex_unlock(&fs->mutex);
+
+	struct pml_fs_req* req;
+	while((req = pop(&done))) {
+		req->cb(req, req->res);
+		req->next = fs->free;
+		fs->free = req;
+	}
+}
+
+static struct pml_fs_req* submit(struct pml_fs* fs, enum op op, int fd,
+		pml_fs_cb cb, void* data) {
+	assert(fs);
+	assert(cb);
+
+	struct pml_fs_req* req = fs->free;
+	if(req) {
+		fs->free = req->next;
+		*req = (struct pml_fs_req) {0};
+	} else {
+		req = calloc(1, sizeof(*req));
+	}
+
+	req->fs = fs;
+	req->op = op;
+	req->fd = fd;
+	req->cb = cb;
+	req->data = data;
+	return req;
+}
+
+static void queue(struct pml_fs_req* req) {
+	struct pml_fs* fs = req->fs;
+	pthread_mutex_lock(&fs->mutex);
+	push(&fs->pending, req);
+	pthread_cond_signal(&fs->cond);
+	pthread_mutex_unlock(&fs->mutex);
+}
+
+static void free_list(struct pml_fs_req* req) {
+	while(req) {
+		struct pml_fs_req* next = req->next;
+		free(req);
+		req = next;
+	}
+}
+
+struct pml_fs* pml_fs_new(struct pml* ml, unsigned n_threads) {
+	assert(ml);
+
+	struct pml_fs* fs = calloc(1, sizeof(*fs));
+	fs->pml = ml;
+	if(pipe(fs->pipe) != 0) {
+		free(fs);
+		return NULL;
+	}
+
+	fcntl(fs->pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(fs->pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fs->pipe[1], F_SETFD, FD_CLOEXEC);
+
+	pthread_mutex_init(&fs->mutex, NULL);
+	pthread_cond_init(&fs->cond, NULL);
+
+	n_threads = n_threads ? n_threads : 1;
+	fs->threads = calloc(n_threads, sizeof(*fs->threads));
+	for(; fs->n_threads < n_threads; ++fs->n_threads) {
+		if(pthread_create(&fs->threads[fs->n_threads], NULL, worker, fs)) {
+			break;
+		}
+	}
+
+	if(!fs->n_threads) {
+		pml_fs_destroy(fs);
+		return NULL;
+	}
+
+	fs->io = pml_io_new(ml, fs->pipe[0], POLLIN, io_cb);
+	pml_io_set_data(fs->io, fs);
+	return fs;
+}
+
+void pml_fs_destroy(struct pml_fs* fs) {
+	if(!fs) {
+		return;
+	}
+
+	pthread_mutex_lock(&fs->mutex);
+	fs->quit = true;
+	pthread_cond_broadcast(&fs->cond);
+	pthread_mutex_unlock(&fs->mutex);
+
+	for(unsigned i = 0u; i < fs->n_threads; ++i) {
+		pthread_join(fs->threads[i], NULL);
+	}
+
+	// fds opened by unreported requests would leak otherwise
+	for(struct pml_fs_req* req = fs->done.first; req; req = req->next) {
+		if(req->op == op_openat && req->res >= 0) {
+			close((int) req->res);
+		}
+	}
+
+	free_list(fs->pending.first);
+	free_list(fs->done.first);
+	free_list(fs->free);
+	free(fs->threads);
+
+	pml_io_destroy(fs->io);
+	close(fs->pipe[0]);
+	close(fs->pipe[1]);
+	pthread_cond_destroy(&fs->cond);
+	pthread_mutex_destroy(&fs->mutex);
+	free(fs);
+}
+
+struct pml_fs_req* pml_fs_read(struct pml_fs* fs, int fd, void* buf,
+		size_t size, off_t offset, pml_fs_cb cb, void* data) {
+	struct pml_fs_req* req = submit(fs, op_read, fd, cb, data);
+	req->buf = buf;
+	req->size = size;
+	req->offset = offset;
+	queue(req);
+	return req;
+}
+
+struct pml_fs_req* pml_fs_write(struct pml_fs* fs, int fd, const void* buf,
+		size_t size, off_t offset, pml_fs_cb cb, void* data) {
+	struct pml_fs_req* req = submit(fs, op_write, fd, cb, data);
+	req->buf = (void*) buf;
+	req->size = size;
+	req->offset = offset;
+	queue(req);
+	return req;
+}
+
+struct pml_fs_req* pml_fs_fsync(struct pml_fs* fs, int fd,
+		pml_fs_cb cb, void* data) {
+	struct pml_fs_req* req = submit(fs, op_fsync, fd, cb, data);
+	queue(req);
+	return req;
+}
+
+struct pml_fs_req* pml_fs_openat(struct pml_fs* fs, int dirfd,
+		const char* path, int flags, mode_t mode, pml_fs_cb cb, void* data) {
+	assert(path);
+	struct pml_fs_req* req = submit(fs, op_openat, dirfd, cb, data);
+	req->path = path;
+	req->flags = flags;
+	req->mode = mode;
+	queue(req);
+	return req;
+}
+
+void* pml_fs_req_get_data(struct pml_fs_req* req) {
+	assert(req);
+	return req->data;
+}
+
+struct pml_fs* pml_fs_req_get_fs(struct pml_fs_req* req) {
+	assert(req);
+	return req->fs;
+}
@@ -0,0 +1,60 @@
+// Copyright 2019 Jan Kelling
+//
+// pml is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 2.1 of the
+// License, or (at your option) any later version.
+
+// Asynchronous file operations for a pml mainloop.
+// Regular files are always ready for poll, so reading them from a pml_io
+// callback blocks the mainloop. pml_fs runs the operations on a small
+// pool of worker threads instead and delivers the completions from a
+// pml_io callback during the mainloop's dispatch phase.
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pml;
+struct pml_fs;
+struct pml_fs_req;
+
+// Called on the mainloop thread when an operation completes.
+// res is the return value of the respective syscall or the negative
+// errno value on failure. The request is only valid until the callback
+// returns.
+typedef void (*pml_fs_cb)(struct pml_fs_req*, ssize_t res);
+
+// Creates a new file operation context for the given mainloop.
+// Starts n_threads worker threads (at least 1).
+// Returns NULL on failure.
+struct pml_fs* pml_fs_new(struct pml*, unsigned n_threads);
+// Waits for the operations currently running on worker threads to
+// finish. The callbacks of pending or unreported operations are not
+// called anymore, fds opened by unreported openat operations are closed.
+// Must not be called from a completion callback.
+void pml_fs_destroy(struct pml_fs*);
+
+// The following functions queue the respective operation and return
+// immediately. The buffers (and path) must stay valid until the
+// callback is called.
+struct pml_fs_req* pml_fs_read(struct pml_fs*, int fd, void* buf,
+	size_t size, off_t offset, pml_fs_cb, void* data);
+struct pml_fs_req* pml_fs_write(struct pml_fs*, int fd, const void* buf,
+	size_t size, off_t offset, pml_fs_cb, void* data);
+struct pml_fs_req* pml_fs_fsync(struct pml_fs*, int fd,
+	pml_fs_cb, void* data);
+struct pml_fs_req* pml_fs_openat(struct pml_fs*, int dirfd, const char* path,
+	int flags, mode_t mode, pml_fs_cb, void* data);
+
+void* pml_fs_req_get_data(struct pml_fs_req*);
+struct pml_fs* pml_fs_req_get_fs(struct pml_fs_req*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+
+unsigned reads = 0u;
+unsigned fired = 0u;
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+	++reads;
+}
+
+void timer_cb(struct pml_timer* t) {
+	++fired;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	pml_set_busy_poll(pml, 1000);
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+	struct pml_io* io = pml_io_new(pml, fds[0], POLLIN, io_cb);
+	struct pml_timer* timer = pml_timer_new(pml, NULL, timer_cb);
+	pml_timer_set_clock(timer, CLOCK_MONOTONIC);
+
+	// ready before polling: found while spinning
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+	pml_iterate(pml, true);
+	assert(reads == 1);
+
+	struct pml_busy_poll_stats stats;
+	pml_get_busy_poll_stats(pml, &stats);
+	assert(stats.spins == 1 && stats.blocks == 0 && stats.skipped == 0);
+
+	// idle: spins for the budget, then blocks until the timer expires
+	struct timespec rel = {.tv_nsec = 5 * 1000 * 1000};
+	pml_timer_set_time_rel(timer, rel);
+	while(!fired) {
+		pml_iterate(pml, true);
+	}
+
+	pml_get_busy_poll_stats(pml, &stats);
+	assert(stats.spins == 1 && stats.blocks >= 1);
+
+	// once events got rare compared to the budget, spinning is skipped
+	rel.tv_nsec = 20 * 1000 * 1000;
+	for(unsigned i = 0u; i < 5 && !stats.skipped; ++i) {
+		unsigned target = fired + 1;
+		pml_timer_set_time_rel(timer, rel);
+		while(fired < target) {
+			pml_iterate(pml, true);
+		}
+		pml_get_busy_poll_stats(pml, &stats);
+	}
+
+	printf("spins: %lu, blocks: %lu, skipped: %lu\n",
+		(unsigned long) stats.spins, (unsigned long) stats.blocks,
+		(unsigned long) stats.skipped);
+	assert(stats.skipped >= 1);
+
+	pml_timer_destroy(timer);
+	pml_io_destroy(io);
+	pml_destroy(pml);
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,98 @@
+#include <pml_coro.hpp>
+#include <cstdio>
+#include <cassert>
+#include <unistd.h>
+#include <ctime>
+
+// false positive, see pml_coro.hpp
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13
+	#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+using namespace std::chrono_literals;
+
+unsigned reads = 0u;
+bool done = false;
+
+pmlpp::task reader(pmlpp::frame_pool&, pmlpp::loop& ml, pmlpp::io& io) {
+	for(auto i = 0u; i < 3; ++i) {
+		unsigned revents = co_await pmlpp::readable(io);
+		assert(revents & POLLIN);
+
+		char c;
+		auto res = read(io.fd(), &c, 1);
+		assert(res == 1);
+		++reads;
+
+		co_await pmlpp::sleep_for(ml, 1ms);
+	}
+
+	done = true;
+}
+
+double slept = 0.0;
+bool hangup_done = false;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The peer hangs up while the coroutine sleeps: that must neither
+// end the sleep early nor touch the finished io awaitable.
+pmlpp::task sleeper(pmlpp::frame_pool&, pmlpp::loop& ml, pmlpp::io& io) {
+	unsigned revents = co_await pmlpp::readable(io);
+	assert(revents & POLLIN);
+
+	auto start = now();
+	co_await pmlpp::sleep_for(ml, 200ms);
+	slept = now() - start;
+	hangup_done = true;
+}
+
+int main() {
+	pmlpp::loop ml;
+	pmlpp::frame_pool pool;
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+
+	pmlpp::io io(ml, fds[0], 0);
+	reader(pool, ml, io);
+
+	res = write(fds[1], "abc", 3);
+	assert(res == 3);
+
+	while(!done) {
+		ml.iterate(true);
+	}
+
+	assert(reads == 3);
+	std::printf("reads: %u\n", reads);
+	close(fds[1]);
+
+	int hfds[2];
+	res = pipe(hfds);
+	assert(res == 0);
+	pmlpp::io hio(ml, hfds[0], 0);
+	sleeper(pool, ml, hio);
+	res = write(hfds[1], "x", 1);
+	assert(res == 1);
+	ml.iterate(true);
+	close(hfds[1]);
+
+	while(!hangup_done) {
+		ml.iterate(true);
+	}
+
+	std::printf("slept: %.3fs\n", slept);
+	assert(slept >= 0.19);
+
+	// the coroutine is gone, the hangup is still reported
+	ml.iterate(false);
+	ml.iterate(false);
+	close(hfds[0]);
+	close(fds[0]);
+}
@@ -0,0 +1,84 @@
+#include <pml.hpp>
+#include <cstdio>
+#include <cassert>
+#include <unistd.h>
+#include <poll.h>
+
+using namespace std::chrono_literals;
+
+struct Conn {
+	unsigned reads {};
+	unsigned timeouts {};
+
+	void readable(unsigned revents) {
+		assert(revents & POLLIN);
+		++reads;
+	}
+
+	void timeout() {
+		++timeouts;
+	}
+};
+
+unsigned deferred = 0u;
+void defer_cb() {
+	++deferred;
+}
+
+int main() {
+	pmlpp::loop ml;
+	Conn conn;
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+
+	pmlpp::io io(ml, fds[0], POLLIN);
+	io.on<&Conn::readable>(&conn);
+
+	pmlpp::timer timer(ml);
+	timer.clock(CLOCK_MONOTONIC);
+	timer.on<&Conn::timeout>(&conn);
+	timer.set_time_rel(1ms);
+
+	pmlpp::defer defer(ml);
+	defer.on<defer_cb>();
+
+	// moving must not affect the registered callbacks
+	pmlpp::io moved = std::move(io);
+	assert(!io && moved);
+
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+
+	ml.iterate(true);
+	assert(conn.reads == 1);
+	assert(deferred == 1);
+
+	defer.enable(false);
+	while(timer.enabled()) {
+		ml.iterate(true);
+	}
+	assert(conn.timeouts == 1);
+
+	// move assignment destroys the previous source right away, even
+	// though the moved-from handle is still alive
+	pmlpp::defer replaced(ml);
+	replaced.on<defer_cb>();
+	pmlpp::defer empty;
+	replaced = std::move(empty);
+	assert(!replaced && !empty);
+	ml.iterate(false);
+	assert(deferred == 1);
+
+	pmlpp::defer other(ml);
+	other.on<defer_cb>();
+	replaced = std::move(other);
+	assert(replaced && !other);
+	ml.iterate(false);
+	assert(deferred == 2);
+
+	std::printf("reads: %u, timeouts: %u\n", conn.reads, conn.timeouts);
+	close(fds[0]);
+	close(fds[1]);
+}
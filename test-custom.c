@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+
+struct source {
+	int fd;
+	unsigned prepared;
+	unsigned checked;
+	unsigned dispatched;
+	unsigned reads;
+};
+
+void prepare(struct pml_custom* c) {
+	struct source* src = pml_custom_get_data(c);
+	++src->prepared;
+}
+
+unsigned query(struct pml_custom* c, struct pollfd* fds, unsigned n_fds,
+		int* timeout) {
+	struct source* src = pml_custom_get_data(c);
+	if(n_fds > 0) {
+		fds[0].fd = src->fd;
+		fds[0].events = POLLIN;
+	}
+	*timeout = -1;
+	return 1;
+}
+
+bool check(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
+	struct source* src = pml_custom_get_data(c);
+	assert(n_fds == 1);
+	assert(fds[0].fd == src->fd);
+	++src->checked;
+	assert(src->checked <= src->prepared);
+	return fds[0].revents & POLLIN;
+}
+
+void dispatch(struct pml_custom* c, struct pollfd* fds, unsigned n_fds) {
+	struct source* src = pml_custom_get_data(c);
+	assert(n_fds == 1);
+	++src->dispatched;
+	if(fds[0].revents & POLLIN) {
+		char b;
+		ssize_t res = read(src->fd, &b, 1);
+		assert(res == 1);
+		++src->reads;
+	}
+}
+
+const struct pml_custom_impl checked_impl = {
+	.prepare = prepare,
+	.query = query,
+	.dispatch = dispatch,
+	.check = check,
+};
+
+const struct pml_custom_impl unchecked_impl = {
+	.prepare = prepare,
+	.query = query,
+	.dispatch = dispatch,
+};
+
+int main() {
+	struct pml* pml = pml_new();
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+
+	struct source a = {.fd = fds[0]};
+	struct source b = {.fd = fds[0]};
+	struct pml_custom* ca = pml_custom_new(pml, &checked_impl);
+	pml_custom_set_data(ca, &a);
+	struct pml_custom* cb = pml_custom_new(pml, &unchecked_impl);
+	pml_custom_set_data(cb, &b);
+
+	// nothing ready: check returns false, dispatch is skipped.
+	// Without check, dispatch is always called.
+	for(unsigned i = 0u; i < 3; ++i) {
+		pml_iterate(pml, false);
+	}
+
+	assert(a.prepared == 3 && a.checked == 3 && a.dispatched == 0);
+	assert(b.prepared == 3 && b.checked == 0 && b.dispatched == 3);
+
+	struct pml_stats stats;
+	pml_stats_read(pml, &stats);
+	assert(stats.custom_dispatches == 3);
+
+	// ready: check returns true, dispatch is called once
+	res = write(fds[1], "xy", 2);
+	assert(res == 2);
+	pml_iterate(pml, false);
+	assert(a.prepared == 4 && a.checked == 4 && a.dispatched == 1);
+	assert(a.reads == 1);
+	assert(b.dispatched == 4 && b.reads == 1);
+
+	// fine-grained iteration control: querying multiple times doesn't
+	// lead to additional checks, check runs once per prepare
+	struct pollfd pfds[2];
+	int timeout;
+	pml_prepare(pml);
+	unsigned n = pml_query(pml, pfds, 2, &timeout);
+	assert(n == 2);
+	n = pml_query(pml, pfds, 2, &timeout);
+	assert(n == 2);
+	for(unsigned i = 0u; i < n; ++i) {
+		pfds[i].revents = 0;
+	}
+	pml_poll(pml, 0);
+	pml_dispatch(pml, pfds, n);
+	assert(a.prepared == 5 && a.checked == 5 && a.dispatched == 1);
+	assert(b.dispatched == 5);
+
+	// a source created after preparation is neither checked
+	// nor dispatched in that iteration
+	struct source c = {.fd = fds[0]};
+	pml_prepare(pml);
+	n = pml_query(pml, pfds, 2, &timeout);
+	assert(n == 2);
+	struct pml_custom* cc = pml_custom_new(pml, &checked_impl);
+	pml_custom_set_data(cc, &c);
+	pml_poll(pml, 0);
+	pml_dispatch(pml, pfds, n);
+	assert(c.prepared == 0 && c.checked == 0 && c.dispatched == 0);
+
+	pml_iterate(pml, false);
+	assert(c.prepared == 1 && c.checked == 1 && c.dispatched == 0);
+	assert(a.checked == a.prepared && a.prepared == 7);
+
+	pml_stats_read(pml, &stats);
+	assert(stats.custom_dispatches == 1 + b.dispatched);
+
+	pml_custom_destroy(cc);
+	pml_custom_destroy(cb);
+	pml_custom_destroy(ca);
+	pml_destroy(pml);
+	close(fds[0]);
+	close(fds[1]);
+}
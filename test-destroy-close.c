@@ -0,0 +1,61 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+#define N 8
+
+struct pml_io* ios[N];
+int fds[N][2];
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	// tear down all ios from the first callback
+	for(unsigned i = 0u; i < N; ++i) {
+		if(ios[i]) {
+			pml_io_destroy_close(ios[i]);
+			ios[i] = NULL;
+		}
+	}
+
+	// not closed before dispatching finishes
+	for(unsigned i = 0u; i < N; ++i) {
+		assert(fcntl(fds[i][0], F_GETFD) != -1);
+	}
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	for(unsigned i = 0u; i < N; ++i) {
+		int res = pipe(fds[i]);
+		assert(res == 0);
+		ios[i] = pml_io_new(pml, fds[i][0], POLLIN, io_cb);
+		res = write(fds[i][1], "x", 1);
+		assert(res == 1);
+	}
+
+	pml_iterate(pml, false);
+	for(unsigned i = 0u; i < N; ++i) {
+		assert(ios[i] == NULL);
+		assert(fcntl(fds[i][0], F_GETFD) == -1);
+		close(fds[i][1]);
+	}
+
+	struct pml_stats stats;
+	pml_stats_read(pml, &stats);
+	assert(stats.io_callbacks == 1);
+	assert(stats.close_calls >= 1 && stats.close_calls <= N);
+
+	// outside of dispatch the fd is closed immediately
+	int p[2];
+	int res = pipe(p);
+	assert(res == 0);
+	pml_io_destroy_close(pml_io_new(pml, p[0], POLLIN, io_cb));
+	assert(fcntl(p[0], F_GETFD) == -1);
+	close(p[1]);
+
+	pml_destroy(pml);
+}
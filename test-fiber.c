@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <pml_fiber.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+unsigned reads = 0u;
+unsigned finished = 0u;
+
+static void reader(struct pml_fiber* f) {
+	int fd = *(int*) pml_fiber_get_data(f);
+	for(unsigned i = 0u; i < 3; ++i) {
+		unsigned revents = pml_fiber_wait_io(fd, POLLIN);
+		assert(revents & POLLIN);
+
+		char c;
+		ssize_t res = read(fd, &c, 1);
+		assert(res == 1);
+		++reads;
+
+		struct timespec rel = {.tv_nsec = 1000 * 1000};
+		pml_fiber_sleep(rel);
+	}
+
+	++finished;
+}
+
+double slept[2];
+unsigned sleeps = 0u;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The peer hangs up while the fiber sleeps: that must neither end
+// the sleeps early nor resume the fiber a second time.
+static void sleeper(struct pml_fiber* f) {
+	int fd = *(int*) pml_fiber_get_data(f);
+	unsigned revents = pml_fiber_wait_io(fd, POLLIN);
+	assert(revents & POLLIN);
+
+	struct timespec rel = {.tv_nsec = 200 * 1000 * 1000};
+	for(unsigned i = 0u; i < 2; ++i) {
+		double start = now();
+		pml_fiber_sleep(rel);
+		slept[sleeps++] = now() - start;
+	}
+
+	++finished;
+}
+
+static void instant(struct pml_fiber* f) {
+	++finished;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_fiber_pool* pool = pml_fiber_pool_new(pml, 0, 4);
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+
+	// two fibers one after another, the second one re-uses the stack
+	for(unsigned i = 0u; i < 2; ++i) {
+		struct pml_fiber* f = pml_fiber_new(pool, reader, &fds[0]);
+		assert(f);
+		assert(!pml_fiber_current());
+
+		res = write(fds[1], "abc", 3);
+		assert(res == 3);
+
+		while(finished == i) {
+			pml_iterate(pml, true);
+		}
+	}
+
+	assert(reads == 6);
+	printf("reads: %u\n", reads);
+
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+	struct pml_fiber* f = pml_fiber_new(pool, sleeper, &fds[0]);
+	assert(f);
+	pml_iterate(pml, true);
+	close(fds[1]);
+	while(finished == 2) {
+		pml_iterate(pml, true);
+	}
+
+	printf("slept: %.3fs %.3fs\n", slept[0], slept[1]);
+	assert(sleeps == 2);
+	assert(slept[0] >= 0.19 && slept[1] >= 0.19);
+
+	// the fiber is destroyed when it finishes synchronously
+	assert(pml_fiber_new(pool, instant, NULL) == NULL);
+	assert(finished == 4);
+
+	pml_fiber_pool_destroy(pool);
+	pml_destroy(pml);
+	close(fds[0]);
+}
@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <pml_fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+char path[] = "/tmp/pml-test-fs-XXXXXX";
+const char msg[] = "hello pml_fs";
+char buf[64];
+int fd = -1;
+unsigned step = 0u;
+unsigned late = 0u;
+
+void read_cb(struct pml_fs_req* req, ssize_t res) {
+	assert(step == 3);
+	assert(res == (ssize_t) sizeof(msg));
+	assert(memcmp(buf, msg, sizeof(msg)) == 0);
+	++step;
+}
+
+void fsync_cb(struct pml_fs_req* req, ssize_t res) {
+	assert(step == 2);
+	assert(res == 0);
+	++step;
+	pml_fs_read(pml_fs_req_get_fs(req), fd, buf, sizeof(buf), 0,
+		read_cb, NULL);
+}
+
+void write_cb(struct pml_fs_req* req, ssize_t res) {
+	assert(step == 1);
+	assert(res == (ssize_t) sizeof(msg));
+	++step;
+	pml_fs_fsync(pml_fs_req_get_fs(req), fd, fsync_cb, NULL);
+}
+
+void open_cb(struct pml_fs_req* req, ssize_t res) {
+	assert(step == 0);
+	assert(res >= 0);
+	assert(pml_fs_req_get_data(req) == path);
+	fd = (int) res;
+	++step;
+	pml_fs_write(pml_fs_req_get_fs(req), fd, msg, sizeof(msg), 0,
+		write_cb, NULL);
+}
+
+void error_cb(struct pml_fs_req* req, ssize_t res) {
+	assert(res == -ENOENT);
+	++step;
+}
+
+void late_cb(struct pml_fs_req* req, ssize_t res) {
+	++late;
+}
+
+unsigned count_fds(void) {
+	unsigned count = 0u;
+	for(int i = 0; i < 1024; ++i) {
+		count += (fcntl(i, F_GETFD) != -1);
+	}
+	return count;
+}
+
+int main() {
+	int tmp = mkstemp(path);
+	assert(tmp >= 0);
+	close(tmp);
+
+	struct pml* pml = pml_new();
+	struct pml_fs* fs = pml_fs_new(pml, 2);
+	assert(fs);
+
+	// openat -> write -> fsync -> read, each started from the completion
+	// of the previous one
+	pml_fs_openat(fs, AT_FDCWD, path, O_RDWR, 0, open_cb, path);
+	while(step < 4) {
+		pml_iterate(pml, true);
+	}
+
+	// errors are reported as negative errno values
+	pml_fs_openat(fs, AT_FDCWD, "/nonexistent/pml", O_RDONLY, 0,
+		error_cb, NULL);
+	while(step < 5) {
+		pml_iterate(pml, true);
+	}
+
+	// destroying with requests in flight: the running ones are waited
+	// for, no callbacks are called anymore
+	static char bufs[64][64];
+	for(unsigned i = 0u; i < 64; ++i) {
+		pml_fs_read(fs, fd, bufs[i], sizeof(bufs[i]), 0, late_cb, NULL);
+		pml_fs_fsync(fs, fd, late_cb, NULL);
+	}
+	pml_fs_destroy(fs);
+	pml_iterate(pml, false);
+	assert(late == 0);
+
+	close(fd);
+
+	// fds opened by requests that completed but weren't reported
+	// are closed by pml_fs_destroy
+	unsigned before = count_fds();
+	fs = pml_fs_new(pml, 2);
+	assert(fs);
+	unsigned created = count_fds();
+	for(unsigned i = 0u; i < 16; ++i) {
+		pml_fs_openat(fs, AT_FDCWD, path, O_RDONLY, 0, late_cb, NULL);
+	}
+	struct timespec wait = {.tv_nsec = 50 * 1000 * 1000};
+	nanosleep(&wait, NULL);
+	assert(count_fds() > created);
+	pml_fs_destroy(fs);
+	pml_iterate(pml, false);
+	assert(late == 0);
+	assert(count_fds() == before);
+
+	unlink(path);
+	pml_destroy(pml);
+}
@@ -0,0 +1,52 @@
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+
+unsigned prepared = 0u;
+unsigned checked = 0u;
+unsigned deferred = 0u;
+
+void defer_cb(struct pml_defer* d) {
+	// only checks hook for this iteration already ran
+	assert(checked == prepared);
+	++deferred;
+	pml_defer_enable(d, false);
+}
+
+void prepare_cb(struct pml_hook* h) {
+	++prepared;
+
+	// enabled before timeouts are computed, so the blocking iteration
+	// below must not block
+	pml_defer_enable(pml_hook_get_data(h), true);
+}
+
+void check_cb(struct pml_hook* h) {
+	++checked;
+	if(checked == 2) {
+		pml_hook_destroy(h);
+	}
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_defer* defer = pml_defer_new(pml, defer_cb);
+	pml_defer_enable(defer, false);
+
+	struct pml_hook* prepare = pml_hook_new(pml, pml_hook_prepare, prepare_cb);
+	pml_hook_set_data(prepare, defer);
+	pml_hook_new(pml, pml_hook_check, check_cb);
+
+	pml_iterate(pml, true);
+	pml_iterate(pml, true);
+	assert(prepared == 2 && checked == 2 && deferred == 2);
+
+	// check hook destroyed itself
+	pml_hook_destroy(prepare);
+	pml_defer_enable(defer, true);
+	pml_iterate(pml, true);
+	assert(prepared == 2 && checked == 2 && deferred == 3);
+
+	printf("prepared: %u, checked: %u\n", prepared, checked);
+	pml_destroy(pml);
+}
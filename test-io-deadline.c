@@ -0,0 +1,75 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+unsigned reads = 0u;
+unsigned timeouts = 0u;
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	struct timespec rel = {.tv_nsec = 5 * 1000 * 1000};
+	if(revents == pml_io_timeout) {
+		++timeouts;
+		return;
+	}
+
+	assert(revents & POLLIN);
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+	++reads;
+
+	// activity: move the deadline back
+	pml_io_set_deadline(io, &rel);
+}
+
+int main() {
+	struct pml* pml = pml_new();
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+
+	struct pml_io* io = pml_io_new(pml, fds[0], POLLIN, io_cb);
+	struct timespec rel = {.tv_nsec = 5 * 1000 * 1000};
+	pml_io_set_deadline(io, &rel);
+
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+	pml_iterate(pml, true);
+	assert(reads == 1 && timeouts == 0);
+
+	while(!timeouts) {
+		pml_iterate(pml, true);
+	}
+	assert(reads == 1 && timeouts == 1);
+
+	// outside of dispatching, the deadline is relative to the current
+	// time, not to the start of the last dispatch
+	struct timespec block = {.tv_nsec = 50 * 1000 * 1000};
+	nanosleep(&block, NULL);
+	struct timespec longer = {.tv_nsec = 30 * 1000 * 1000};
+	pml_io_set_deadline(io, &longer);
+	pml_iterate(pml, false);
+	assert(timeouts == 1);
+	while(timeouts == 1) {
+		pml_iterate(pml, true);
+	}
+	assert(reads == 1 && timeouts == 2);
+
+	// disabled deadline: destroying the io must not leave it queued
+	pml_io_set_deadline(io, &rel);
+	pml_io_set_deadline(io, NULL);
+	pml_io_set_deadline(io, &rel);
+	pml_io_destroy(io);
+	pml_iterate(pml, false);
+
+	printf("reads: %u, timeouts: %u\n", reads, timeouts);
+	pml_destroy(pml);
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,72 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+
+#define N_PIPES 4
+
+int pipes[N_PIPES + 1][2];
+struct pml_io* ios[N_PIPES + 1];
+unsigned calls = 0u;
+unsigned events = 0u;
+
+void group_cb(struct pml_io_group* g, const struct pml_io_event* evs,
+		unsigned count) {
+	++calls;
+	for(unsigned i = 0u; i < count; ++i) {
+		unsigned id = (unsigned) (size_t) evs[i].data;
+		assert(id != 2);
+		assert(evs[i].revents & POLLIN);
+		char c;
+		ssize_t res = read(pipes[id][0], &c, 1);
+		assert(res == 1);
+		++events;
+	}
+}
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+
+	// batched but not yet dispatched member
+	pml_io_destroy(ios[2]);
+	ios[2] = NULL;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_io_group* group = pml_io_group_new(pml, group_cb);
+	for(unsigned i = 0u; i <= N_PIPES; ++i) {
+		int res = pipe(pipes[i]);
+		assert(res == 0);
+		ios[i] = pml_io_new(pml, pipes[i][0], POLLIN, io_cb);
+		pml_io_set_data(ios[i], (void*) (size_t) i);
+		res = write(pipes[i][1], "x", 1);
+		assert(res == 1);
+	}
+
+	// the last io isn't in the group
+	for(unsigned i = 0u; i < N_PIPES; ++i) {
+		pml_io_set_group(ios[i], group);
+	}
+
+	pml_iterate(pml, false);
+	assert(calls == 1);
+	assert(events == N_PIPES - 1);
+
+	pml_iterate(pml, false);
+	assert(calls == 1);
+
+	printf("calls: %u, events: %u\n", calls, events);
+	for(unsigned i = 0u; i <= N_PIPES; ++i) {
+		pml_io_destroy(ios[i]);
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+	pml_io_group_destroy(group);
+	pml_destroy(pml);
+}
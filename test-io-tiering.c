@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+
+#define N_PIPES 8
+
+int pipes[N_PIPES][2];
+unsigned reads[N_PIPES];
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	unsigned i = (unsigned) (size_t) pml_io_get_data(io);
+	assert(revents & POLLIN);
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+	++reads[i];
+}
+
+// Runs one non-blocking iteration using the external integration path,
+// returns the number of polled fds.
+unsigned iterate(struct pml* pml) {
+	struct pollfd fds[N_PIPES + 1];
+	int timeout;
+	pml_prepare(pml);
+	unsigned n = pml_query(pml, fds, N_PIPES + 1, &timeout);
+	assert(n <= N_PIPES + 1);
+	poll(fds, n, 0);
+	pml_poll(pml, 0); // only moves the mainloop into the polled state
+	pml_dispatch(pml, fds, n);
+	return n;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_io* ios[N_PIPES];
+	for(unsigned i = 0u; i < N_PIPES; ++i) {
+		int res = pipe(pipes[i]);
+		assert(res == 0);
+		ios[i] = pml_io_new(pml, pipes[i][0], POLLIN, io_cb);
+		pml_io_set_data(ios[i], (void*) (size_t) i);
+	}
+
+	pml_set_io_tiering(pml, 2);
+	assert(iterate(pml) == N_PIPES);
+
+	// keep pipe 0 active, all others become cold
+	unsigned n = 0;
+	for(unsigned i = 0u; i < 8; ++i) {
+		ssize_t res = write(pipes[0][1], "x", 1);
+		assert(res == 1);
+		n = iterate(pml);
+	}
+	assert(n == 2);
+	assert(reads[0] == 8);
+
+	// cold io becomes ready: dispatched from the epoll set and promoted
+	ssize_t res = write(pipes[3][1], "x", 1);
+	assert(res == 1);
+	res = write(pipes[0][1], "x", 1);
+	assert(res == 1);
+	iterate(pml);
+	assert(reads[3] == 1);
+	assert(iterate(pml) == 3);
+
+	// changing events and destroying cold sources
+	pml_io_set_events(ios[5], 0);
+	res = write(pipes[5][1], "x", 1);
+	assert(res == 1);
+	iterate(pml);
+	assert(reads[5] == 0);
+	pml_io_set_events(ios[5], POLLIN);
+	pml_io_destroy(ios[6]);
+	iterate(pml);
+	assert(reads[5] == 1);
+
+	// disabling moves everything back
+	pml_set_io_tiering(pml, 0);
+	assert(iterate(pml) == N_PIPES - 1);
+
+	printf("reads: %u %u %u\n", reads[0], reads[3], reads[5]);
+	pml_destroy(pml);
+	for(unsigned i = 0u; i < N_PIPES; ++i) {
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+}
@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+
+unsigned reads = 0u;
+unsigned changes = 0u;
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+	++reads;
+}
+
+void timer_cb(struct pml_timer* t) {
+}
+
+void lag_cb(struct pml* pml, bool shedding, void* data) {
+	++changes;
+	assert(shedding == pml_is_shedding(pml));
+}
+
+int main() {
+	struct pml* pml = pml_new();
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+	struct pml_io* io = pml_io_new(pml, fds[0], POLLIN, io_cb);
+	pml_io_set_sheddable(io, true);
+
+	struct timespec high = {.tv_nsec = 10 * 1000 * 1000};
+	struct timespec low = {.tv_nsec = 5 * 1000 * 1000};
+	pml_set_lag_monitor(pml, &high, &low, lag_cb, NULL);
+
+	// a timer that is 1s late
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	time.tv_sec -= 1;
+	struct pml_timer* timer = pml_timer_new(pml, NULL, timer_cb);
+	pml_timer_set_clock(timer, CLOCK_MONOTONIC);
+	pml_timer_set_time(timer, time);
+	pml_iterate(pml, false);
+	assert(!pml_is_shedding(pml));
+
+	// the io isn't dispatched while shedding
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+	pml_iterate(pml, false);
+	assert(pml_is_shedding(pml) && changes == 1);
+	assert(reads == 0);
+
+	// the internal timer fires in time, lag recovers
+	while(pml_is_shedding(pml)) {
+		pml_iterate(pml, true);
+	}
+	assert(changes == 2);
+	pml_iterate(pml, false);
+	assert(reads == 1);
+
+	// once idle, the probe stops re-arming itself and doesn't wake up
+	// the mainloop anymore
+	int timeout = 0;
+	for(unsigned i = 0u; i < 10 && timeout != -1; ++i) {
+		struct pollfd pfds[4];
+		pml_prepare(pml);
+		unsigned n = pml_query(pml, pfds, 4, &timeout);
+		n = n < 4 ? n : 4;
+		pml_poll(pml, timeout == -1 ? 0 : timeout);
+		for(unsigned j = 0u; j < n; ++j) {
+			pfds[j].revents = 0;
+		}
+		pml_dispatch(pml, pfds, n);
+	}
+	assert(timeout == -1);
+
+	// the probe is armed again when there is work
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+	pml_iterate(pml, false);
+	assert(reads == 2);
+	{
+		struct pollfd pfds[4];
+		pml_prepare(pml);
+		unsigned n = pml_query(pml, pfds, 4, &timeout);
+		n = n < 4 ? n : 4;
+		assert(timeout > 0);
+		pml_poll(pml, 0);
+		for(unsigned j = 0u; j < n; ++j) {
+			pfds[j].revents = 0;
+		}
+		pml_dispatch(pml, pfds, n);
+	}
+
+	printf("reads: %u, changes: %u\n", reads, changes);
+	pml_set_lag_monitor(pml, NULL, NULL, NULL, NULL);
+	pml_timer_destroy(timer);
+	pml_io_destroy(io);
+	pml_destroy(pml);
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,72 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+unsigned logged = 0u;
+unsigned dropped = 0u;
+
+void log_cb(struct pml* pml, const char* msg, void* data) {
+	assert(data == &logged);
+	if(strstr(msg, "dropped")) {
+		++dropped;
+	} else {
+		assert(strstr(msg, "clock_gettime"));
+		++logged;
+	}
+}
+
+unsigned fired = 0u;
+
+void timer_cb(struct pml_timer* t) {
+	++fired;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+
+	// an invalid clock makes pml_timer_set_time_rel fail
+	struct pml_timer* timer = pml_timer_new(pml, NULL, timer_cb);
+	pml_timer_set_clock(timer, (pml_clockid) 0x7fff);
+	struct timespec rel = {0};
+	int res = pml_timer_set_time_rel(timer, rel);
+	assert(res != 0);
+
+	// not drained on the mainloop thread by default
+	pml_iterate(pml, false);
+	assert(logged == 0);
+
+	// opt into draining at the end of dispatch
+	pml_set_log_cb(pml, log_cb, &logged);
+	pml_iterate(pml, false);
+	assert(logged == 1);
+
+	// manual draining, with dropped messages
+	pml_set_log_cb(pml, NULL, NULL);
+	for(unsigned i = 0u; i < 100; ++i) {
+		pml_timer_set_time_rel(timer, rel);
+	}
+	pml_iterate(pml, false);
+	assert(logged == 1);
+
+	unsigned count = pml_log_drain(pml, log_cb, &logged);
+	assert(count > 0 && count < 100);
+	assert(logged == 1 + count);
+	assert(dropped == 1);
+	assert(pml_log_drain(pml, log_cb, &logged) == 0);
+
+	// an enabled timer with a clock that can't be read is skipped
+	// (and the error logged) instead of using an uninitialized time
+	pml_timer_set_time(timer, rel);
+	pml_set_log_cb(pml, log_cb, &logged);
+	count = logged;
+	pml_iterate(pml, false);
+	assert(fired == 0);
+	assert(logged == count + 1);
+
+	pml_timer_destroy(timer);
+	pml_destroy(pml);
+}
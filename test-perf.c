@@ -0,0 +1,43 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+
+unsigned called = 0u;
+
+void defer_cb(struct pml_defer* d) {
+	++called;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_defer* defer = pml_defer_new(pml, defer_cb);
+
+	struct pml_perf_counters counters[pml_perf_phase_count];
+	int res = pml_set_perf(pml, true);
+	for(unsigned i = 0u; i < 10; ++i) {
+		pml_iterate(pml, false);
+	}
+	assert(called == 10);
+
+	pml_get_perf(pml, counters);
+	if(res != 0) {
+		// perf events aren't available, nothing is measured
+		printf("perf events unavailable: %d\n", res);
+		for(unsigned i = 0u; i < pml_perf_phase_count; ++i) {
+			assert(counters[i].calls == 0);
+		}
+	} else {
+		assert(counters[pml_perf_prepare].calls == 10);
+		assert(counters[pml_perf_poll].calls == 10);
+		assert(counters[pml_perf_dispatch].calls == 10);
+		assert(counters[pml_perf_defer].calls == 10);
+		assert(counters[pml_perf_dispatch].instructions >=
+			counters[pml_perf_defer].instructions);
+	}
+
+	pml_set_perf(pml, false);
+	pml_defer_destroy(defer);
+	pml_destroy(pml);
+}
@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdlib.h>
+
+// Counts the allocations while counting is set. pml is linked
+// dynamically, so these replace the allocator for it as well.
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+
+bool counting = false;
+unsigned allocations = 0u;
+
+void* malloc(size_t size) {
+	allocations += counting;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+	allocations += counting;
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	allocations += counting;
+	return __libc_realloc(ptr, size);
+}
+
+unsigned called = 0u;
+
+void timer_cb(struct pml_timer* t) {
+	++called;
+}
+
+void task_cb(void* arg) {
+	++called;
+}
+
+unsigned batched = 0u;
+
+void timer_group_cb(struct pml_timer_group* g, void** data, unsigned count) {
+	batched += count;
+}
+
+void io_cb(struct pml_io* io, unsigned revents) {
+}
+
+void io_group_cb(struct pml_io_group* g, const struct pml_io_event* events,
+		unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		char c;
+		ssize_t res = read(*(int*) events[i].data, &c, 1);
+		assert(res == 1);
+	}
+	batched += count;
+}
+
+// Dispatches the group again from a nested iteration, after removing
+// and re-adding a member.
+unsigned nested = 0u;
+struct pml_io* nested_ios[2];
+int nested_fds[2][2];
+
+void nested_group_cb(struct pml_io_group* g, const struct pml_io_event* events,
+		unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		char c;
+		ssize_t res = read(*(int*) events[i].data, &c, 1);
+		assert(res == 1);
+	}
+
+	if(nested++) {
+		return;
+	}
+
+	pml_io_set_group(nested_ios[1], NULL);
+	pml_io_set_group(nested_ios[1], g);
+	for(unsigned i = 0u; i < 2; ++i) {
+		ssize_t res = write(nested_fds[i][1], "x", 1);
+		assert(res == 1);
+	}
+
+	// the first nested iteration only finishes the outer dispatch
+	struct pml* pml = pml_io_group_get_pml(g);
+	pml_iterate(pml, false);
+	pml_iterate(pml, false);
+	assert(nested == 2);
+
+	// the outer events are still valid
+	assert(count == 2);
+	assert(events[0].revents & POLLIN && events[1].revents & POLLIN);
+}
+
+int main() {
+	struct pml* pml = pml_new();
+
+	// locking might fail due to RLIMIT_MEMLOCK, realtime mode is
+	// enabled anyways
+	struct pml_realtime rt = {
+		.max_fds = 16,
+		.max_timers = 16,
+		.max_tasks = 16,
+	};
+	pml_set_realtime(pml, &rt);
+
+	struct pml_timer* timers[8];
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(unsigned i = 0u; i < 8; ++i) {
+		timers[i] = pml_timer_new(pml, NULL, timer_cb);
+		pml_timer_set_clock(timers[i], CLOCK_MONOTONIC);
+		pml_timer_set_time(timers[i], now);
+		pml_schedule(pml, task_cb, NULL, now);
+	}
+
+	pml_iterate(pml, false);
+	assert(called == 16);
+
+	struct pml_realtime_stats stats;
+	pml_get_realtime_stats(pml, &stats);
+	assert(stats.iterations == 1);
+	assert(stats.last_iteration_ns > 0);
+	assert(stats.max_iteration_ns >= stats.last_iteration_ns);
+
+	// dispatching groups doesn't allocate either (it would abort)
+	struct pml_timer_group* tgroup = pml_timer_group_new(pml, timer_group_cb);
+	for(unsigned i = 0u; i < 8; ++i) {
+		pml_timer_set_group(timers[i], tgroup);
+		pml_timer_set_time(timers[i], now);
+	}
+
+	int fds[2][2];
+	struct pml_io* ios[2];
+	struct pml_io_group* igroup = pml_io_group_new(pml, io_group_cb);
+	for(unsigned i = 0u; i < 2; ++i) {
+		int res = pipe(fds[i]);
+		assert(res == 0);
+		ios[i] = pml_io_new(pml, fds[i][0], POLLIN, io_cb);
+		pml_io_set_data(ios[i], &fds[i][0]);
+		pml_io_set_group(ios[i], igroup);
+		res = write(fds[i][1], "x", 1);
+		assert(res == 1);
+	}
+
+	pml_iterate(pml, false);
+	assert(batched == 10);
+
+	// nested dispatch of a group doesn't allocate either
+	struct pml_io_group* ngroup = pml_io_group_new(pml, nested_group_cb);
+	for(unsigned i = 0u; i < 2; ++i) {
+		int res = pipe(nested_fds[i]);
+		assert(res == 0);
+		nested_ios[i] = pml_io_new(pml, nested_fds[i][0], POLLIN, io_cb);
+		pml_io_set_data(nested_ios[i], &nested_fds[i][0]);
+		pml_io_set_group(nested_ios[i], ngroup);
+		res = write(nested_fds[i][1], "x", 1);
+		assert(res == 1);
+	}
+
+	counting = true;
+	pml_iterate(pml, false);
+	counting = false;
+	assert(nested == 2);
+	assert(allocations == 0u);
+
+	for(unsigned i = 0u; i < 2; ++i) {
+		pml_io_destroy(nested_ios[i]);
+		close(nested_fds[i][0]);
+		close(nested_fds[i][1]);
+	}
+	pml_io_group_destroy(ngroup);
+
+	pml_set_realtime(pml, NULL);
+	for(unsigned i = 0u; i < 8; ++i) {
+		pml_timer_destroy(timers[i]);
+	}
+	for(unsigned i = 0u; i < 2; ++i) {
+		pml_io_destroy(ios[i]);
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	pml_timer_group_destroy(tgroup);
+	pml_io_group_destroy(igroup);
+
+	pml_destroy(pml);
+
+	// many expired timers with flat storage: sorting them by lateness
+	// must not allocate (glibc's qsort would for arrays this large)
+	pml = pml_new();
+	pml_set_timer_storage(pml, pml_timer_storage_flat);
+	rt.max_timers = 512;
+	pml_set_realtime(pml, &rt);
+
+	struct pml_timer* many[500];
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(unsigned i = 0u; i < 500; ++i) {
+		many[i] = pml_timer_new(pml, NULL, timer_cb);
+		pml_timer_set_clock(many[i], CLOCK_MONOTONIC);
+		struct timespec t = now;
+		t.tv_nsec = (t.tv_nsec + 997 * i) % 1000000000;
+		pml_timer_set_time(many[i], t);
+	}
+
+	called = 0u;
+	counting = true;
+	pml_iterate(pml, false);
+	counting = false;
+	assert(called == 500);
+	assert(allocations == 0u);
+
+	// tiering keeps working in realtime mode: idle ios are moved into
+	// the epoll fd without allocating
+	for(unsigned i = 0u; i < 2; ++i) {
+		int res = pipe(fds[i]);
+		assert(res == 0);
+		ios[i] = pml_io_new(pml, fds[i][0], POLLIN, io_cb);
+	}
+
+	pml_set_io_tiering(pml, 2);
+	counting = true;
+	for(unsigned i = 0u; i < 4; ++i) {
+		pml_iterate(pml, false);
+	}
+	counting = false;
+	assert(allocations == 0u);
+
+	struct pollfd pfds[4];
+	int timeout;
+	pml_prepare(pml);
+	unsigned n = pml_query(pml, pfds, 4, &timeout);
+	assert(n == 1); // only the epoll fd
+	for(unsigned i = 0u; i < n; ++i) {
+		pfds[i].revents = 0;
+	}
+	pml_poll(pml, 0);
+	pml_dispatch(pml, pfds, n);
+
+	for(unsigned i = 0u; i < 2; ++i) {
+		pml_io_destroy(ios[i]);
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	for(unsigned i = 0u; i < 500; ++i) {
+		pml_timer_destroy(many[i]);
+	}
+
+	// destroying unlocks the arrays
+	pml_destroy(pml);
+}
@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+static void spin_cb(struct pml_defer* d) {
+	// burn ~20ms of cpu time
+	struct timespec start, now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	do {
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	} while((now.tv_sec - start.tv_sec) * 1000 * 1000 * 1000 +
+		(now.tv_nsec - start.tv_nsec) < 20 * 1000 * 1000);
+}
+
+static unsigned timeouts = 0u;
+
+static void timeout_cb(struct pml_io* io, unsigned revents) {
+	assert(revents == pml_io_timeout);
+	++timeouts;
+	spin_cb(NULL);
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_defer* defer = pml_defer_new(pml, spin_cb);
+
+	int res = pml_sampler_start(1000);
+	assert(res == 0);
+	assert(pml_sampler_start(1000) == -EBUSY);
+	for(unsigned i = 0u; i < 10; ++i) {
+		pml_iterate(pml, false);
+	}
+	pml_sampler_stop();
+
+	struct pml_sample samples[4];
+	struct pml_sampler_stats stats;
+	unsigned count = pml_sampler_report(samples, 4, &stats);
+	printf("%u entries, %lu samples\n", count, (unsigned long) stats.samples);
+	assert(count >= 1);
+	assert(samples[0].type == pml_sample_defer);
+	assert(samples[0].cb == (void (*)(void)) spin_cb);
+	assert(samples[0].source == defer);
+	assert(samples[0].nested == 0);
+	assert(stats.samples >= samples[0].samples + stats.idle);
+
+	pml_defer_destroy(defer);
+
+	// io timeouts are attributed to the io callback, not to the
+	// internal deadline timer
+	int fds[2];
+	res = pipe(fds);
+	assert(res == 0);
+	struct pml_io* io = pml_io_new(pml, fds[0], POLLIN, timeout_cb);
+
+	res = pml_sampler_start(1000);
+	assert(res == 0);
+	struct timespec rel = {0};
+	for(unsigned i = 0u; i < 10; ++i) {
+		pml_io_set_deadline(io, &rel);
+		pml_iterate(pml, false);
+	}
+	pml_sampler_stop();
+	assert(timeouts == 10);
+
+	count = pml_sampler_report(samples, 4, &stats);
+	assert(count >= 1);
+	assert(samples[0].type == pml_sample_io);
+	assert(samples[0].cb == (void (*)(void)) timeout_cb);
+	assert(samples[0].source == io);
+
+	pml_io_destroy(io);
+	close(fds[0]);
+	close(fds[1]);
+	pml_destroy(pml);
+}
@@ -0,0 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+struct pml* pml;
+unsigned count = 0u;
+int order[8];
+
+void task(void* arg) {
+	int id = (int) (size_t) arg;
+	order[count++] = id;
+
+	// scheduled from a task: called in the next iteration
+	if(id == 1) {
+		struct timespec deadline = {0};
+		pml_schedule(pml, task, (void*) 0, deadline);
+	}
+}
+
+int main() {
+	pml = pml_new();
+
+	struct timespec deadline = {.tv_sec = 10};
+	pml_schedule(pml, task, (void*) 3, deadline);
+	pml_schedule(pml, task, (void*) 4, deadline);
+	deadline.tv_sec = 5;
+	pml_schedule(pml, task, (void*) 2, deadline);
+	deadline.tv_nsec = 1;
+	deadline.tv_sec = 1;
+	pml_schedule(pml, task, (void*) 1, deadline);
+
+	// must not block
+	pml_iterate(pml, true);
+	assert(count == 4);
+	assert(order[0] == 1 && order[1] == 2 && order[2] == 3 && order[3] == 4);
+
+	pml_iterate(pml, true);
+	assert(count == 5 && order[4] == 0);
+
+	printf("tasks: %u\n", count);
+	pml_destroy(pml);
+}
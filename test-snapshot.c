@@ -0,0 +1,169 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+
+uint64_t tokens[] = {0, 1, 2, 3, 4};
+unsigned io_called[2];
+unsigned io_timeouts[2];
+unsigned timer_called[3];
+unsigned loaded = 0u;
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	uint64_t token = *(uint64_t*) pml_io_get_data(io);
+	if(revents == pml_io_timeout) {
+		++io_timeouts[token];
+		return;
+	}
+
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+	++io_called[token];
+}
+
+void timer_cb(struct pml_timer* t) {
+	uint64_t token = *(uint64_t*) pml_timer_get_data(t);
+	++timer_called[token - 2];
+}
+
+bool save_io(void* ud, struct pml_io* io, uint64_t* token) {
+	*token = *(uint64_t*) pml_io_get_data(io);
+	return true;
+}
+
+bool save_timer(void* ud, struct pml_timer* t, uint64_t* token) {
+	*token = *(uint64_t*) pml_timer_get_data(t);
+	return true;
+}
+
+bool load_io(void* ud, uint64_t token, int fd, pml_io_cb* cb, void** data) {
+	int* fds = ud;
+	assert(token < 2);
+	assert(fd == fds[token]);
+	*cb = io_cb;
+	*data = &tokens[token];
+	++loaded;
+	return true;
+}
+
+bool load_timer(void* ud, uint64_t token, pml_timer_cb* cb, void** data) {
+	assert(token >= 2 && token < 5);
+	*cb = timer_cb;
+	*data = &tokens[token];
+	++loaded;
+	return true;
+}
+
+const struct pml_snapshot_impl impl = {
+	save_io, save_timer, load_io, load_timer,
+};
+
+int main() {
+	struct pml* pml = pml_new();
+
+	int pipes[2][2];
+	struct pml_io* ios[2];
+	for(unsigned i = 0u; i < 2; ++i) {
+		int res = pipe(pipes[i]);
+		assert(res == 0);
+		ios[i] = pml_io_new(pml, pipes[i][0], POLLIN, io_cb);
+		pml_io_set_data(ios[i], &tokens[i]);
+	}
+
+	// an expired deadline and one that expires shortly after restoring
+	struct timespec rel = {0};
+	pml_io_set_deadline(ios[0], &rel);
+	rel.tv_nsec = 100 * 1000 * 1000;
+	pml_io_set_deadline(ios[1], &rel);
+
+	// an expired timer, one far in the future and a disabled one
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct timespec later = now;
+	later.tv_sec += 1000;
+	struct pml_timer* timers[3];
+	for(unsigned i = 0u; i < 3; ++i) {
+		timers[i] = pml_timer_new(pml, NULL, timer_cb);
+		pml_timer_set_clock(timers[i], CLOCK_MONOTONIC);
+		pml_timer_set_data(timers[i], &tokens[2 + i]);
+	}
+	pml_timer_set_time(timers[0], now);
+	pml_timer_set_time(timers[1], later);
+
+	size_t size = pml_snapshot(pml, NULL, 0, NULL, &impl, NULL);
+	char* buf = malloc(size);
+	int fds[2];
+	size_t written = pml_snapshot(pml, buf, size, fds, &impl, NULL);
+	assert(written == size);
+	assert(fds[0] == pipes[0][0] && fds[1] == pipes[1][0]);
+
+	for(unsigned i = 0u; i < 2; ++i) {
+		pml_io_destroy(ios[i]);
+	}
+	for(unsigned i = 0u; i < 3; ++i) {
+		pml_timer_destroy(timers[i]);
+	}
+	pml_destroy(pml);
+
+	// invalid snapshots are rejected without creating any source
+	pml = pml_new();
+	char* bad = malloc(size);
+	assert(pml_restore(pml, buf, size - 1, fds, 2, &impl, fds) < 0);
+	assert(pml_restore(pml, buf, 8, fds, 2, &impl, fds) < 0);
+	assert(pml_restore(pml, buf, size, fds, 1, &impl, fds) < 0);
+
+	memcpy(bad, buf, size);
+	bad[0] ^= 0xff; // magic
+	assert(pml_restore(pml, bad, size, fds, 2, &impl, fds) < 0);
+
+	// the io records follow the 16 byte header, 32 bytes each:
+	// token (8 bytes), fd_id (4 bytes), events (4 bytes), deadline
+	// (8 bytes), flags (4 bytes), padding (4 bytes)
+	uint32_t fd_id = 2;
+	memcpy(bad, buf, size);
+	memcpy(bad + 16 + 32 + 8, &fd_id, sizeof(fd_id));
+	assert(pml_restore(pml, bad, size, fds, 2, &impl, fds) < 0);
+
+	fd_id = 0;
+	memcpy(bad + 16 + 32 + 8, &fd_id, sizeof(fd_id));
+	assert(pml_restore(pml, bad, size, fds, 2, &impl, fds) < 0);
+
+	uint32_t n_timer = 0xffffffffu;
+	memcpy(bad, buf, size);
+	memcpy(bad + 12, &n_timer, sizeof(n_timer));
+	assert(pml_restore(pml, bad, size, fds, 2, &impl, fds) < 0);
+	assert(loaded == 0);
+
+	// round trip
+	int res = pml_restore(pml, buf, size, fds, 2, &impl, fds);
+	assert(res == 0);
+	assert(loaded == 5);
+
+	res = write(pipes[1][1], "x", 1);
+	assert(res == 1);
+	pml_iterate(pml, false);
+	assert(io_called[0] == 0 && io_called[1] == 1);
+	assert(timer_called[0] == 1);
+	assert(timer_called[1] == 0 && timer_called[2] == 0);
+	assert(io_timeouts[0] == 1 && io_timeouts[1] == 0);
+
+	while(!io_timeouts[1]) {
+		pml_iterate(pml, true);
+	}
+	assert(io_timeouts[0] == 1);
+
+	free(bad);
+	free(buf);
+	pml_destroy(pml);
+	for(unsigned i = 0u; i < 2; ++i) {
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+}
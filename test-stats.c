@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define N_ITERATIONS 20000u
+
+unsigned reads = 0u;
+unsigned fired = 0u;
+unsigned defered = 0u;
+atomic_bool done = false;
+
+void io_cb(struct pml_io* io, unsigned revents) {
+	char c;
+	ssize_t res = read(pml_io_get_fd(io), &c, 1);
+	assert(res == 1);
+	++reads;
+}
+
+void timer_cb(struct pml_timer* t) {
+	++fired;
+}
+
+void defer_cb(struct pml_defer* d) {
+	++defered;
+	if(!pml_defer_get_data(d)) {
+		pml_defer_enable(d, false);
+	}
+}
+
+// Reads the stats concurrently to the mainloop. Every published snapshot
+// must be consistent: from the fourth iteration on, the defer source is
+// dispatched in every iteration so a torn read would show up as a
+// mismatch between the counters.
+void* reader(void* data) {
+	struct pml* pml = data;
+	struct pml_stats last = {0};
+	unsigned long snapshots = 0u;
+	while(!atomic_load(&done)) {
+		struct pml_stats stats;
+		pml_stats_read(pml, &stats);
+		assert(stats.iterations >= last.iterations);
+		assert(stats.polls >= last.polls);
+		assert(stats.defer_callbacks >= last.defer_callbacks);
+		assert(stats.iterations == stats.defer_callbacks + 2);
+		assert(stats.iterations == stats.polls);
+		assert(stats.io_callbacks == 2 && stats.timer_callbacks == 1);
+		last = stats;
+		++snapshots;
+	}
+
+	printf("snapshots: %lu\n", snapshots);
+	return NULL;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+
+	struct pml_stats stats;
+	pml_stats_read(pml, &stats);
+	assert(stats.iterations == 0 && stats.polls == 0);
+
+	int fds[2];
+	int res = pipe(fds);
+	assert(res == 0);
+	struct pml_io* io = pml_io_new(pml, fds[0], POLLIN, io_cb);
+	struct pml_timer* timer = pml_timer_new(pml, NULL, timer_cb);
+	pml_timer_set_clock(timer, CLOCK_MONOTONIC);
+	struct pml_defer* defer = pml_defer_new(pml, defer_cb);
+
+	// first iteration: every source has something to dispatch
+	res = write(fds[1], "x", 1);
+	assert(res == 1);
+	pml_timer_set_time_rel(timer, (struct timespec) {0});
+	pml_iterate(pml, false);
+	assert(reads == 1 && fired == 1 && defered == 1);
+
+	pml_stats_read(pml, &stats);
+	assert(stats.iterations == 1);
+	assert(stats.polls == 1);
+	assert(stats.poll_ready == 1);
+	assert(stats.io_callbacks == 1);
+	assert(stats.timer_callbacks == 1);
+	assert(stats.defer_callbacks == 1);
+	assert(stats.custom_dispatches == 0);
+
+	// second iteration: only io
+	res = write(fds[1], "y", 1);
+	assert(res == 1);
+	pml_iterate(pml, false);
+	assert(reads == 2);
+
+	// third iteration: nothing ready at all
+	pml_iterate(pml, false);
+
+	pml_stats_read(pml, &stats);
+	assert(stats.iterations == 3);
+	assert(stats.polls == 3);
+	assert(stats.poll_ready == 2);
+	assert(stats.io_callbacks == 2);
+	assert(stats.timer_callbacks == 1);
+	assert(stats.defer_callbacks == 1);
+
+	// concurrent reads while the loop keeps publishing
+	pml_defer_set_data(defer, defer);
+	pml_defer_enable(defer, true);
+
+	pthread_t thread;
+	res = pthread_create(&thread, NULL, reader, pml);
+	assert(res == 0);
+
+	for(unsigned i = 0u; i < N_ITERATIONS; ++i) {
+		pml_iterate(pml, false);
+	}
+
+	atomic_store(&done, true);
+	res = pthread_join(thread, NULL);
+	assert(res == 0);
+
+	pml_stats_read(pml, &stats);
+	assert(stats.iterations == 3 + N_ITERATIONS);
+	assert(stats.polls == 3 + N_ITERATIONS);
+	assert(stats.defer_callbacks == 1 + N_ITERATIONS);
+	assert(stats.io_callbacks == 2);
+	assert(stats.timer_callbacks == 1);
+
+	pml_defer_destroy(defer);
+	pml_timer_destroy(timer);
+	pml_io_destroy(io);
+	pml_destroy(pml);
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,82 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#define N_TIMERS 10
+
+struct pml_timer* timers[N_TIMERS];
+unsigned calls = 0u;
+unsigned expired = 0u;
+unsigned single = 0u;
+
+void group_cb(struct pml_timer_group* g, void** data, unsigned count) {
+	++calls;
+	expired += count;
+	for(unsigned i = 0u; i < count; ++i) {
+		unsigned id = (unsigned) (size_t) data[i];
+		assert(id < N_TIMERS && id != 3);
+		assert(!pml_timer_is_enabled(timers[id]));
+	}
+}
+
+void timer_cb(struct pml_timer* t) {
+	++single;
+	// expired but not yet dispatched member
+	pml_timer_destroy(timers[3]);
+	timers[3] = NULL;
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_timer_group* group = pml_timer_group_new(pml, group_cb);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for(unsigned i = 0u; i < N_TIMERS; ++i) {
+		struct timespec time = now;
+		time.tv_sec -= 10;
+		timers[i] = pml_timer_new(pml, &time, timer_cb);
+		pml_timer_set_data(timers[i], (void*) (size_t) i);
+		pml_timer_set_group(timers[i], group);
+	}
+
+	// not in the group and most overdue, dispatched first
+	struct timespec time = now;
+	time.tv_sec -= 20;
+	struct pml_timer* other = pml_timer_new(pml, &time, timer_cb);
+
+	pml_iterate(pml, false);
+	assert(single == 1);
+	assert(calls == 1);
+	assert(expired == N_TIMERS - 1);
+
+	pml_iterate(pml, false);
+	assert(calls == 1);
+
+	// the dispatch limit counts members individually, the rest is
+	// carried over to the following iterations (timer 3 is gone)
+	pml_set_timer_dispatch_limit(pml, 4);
+	for(unsigned i = 0u; i < N_TIMERS; ++i) {
+		if(timers[i]) {
+			pml_timer_set_time(timers[i], now);
+		}
+	}
+
+	unsigned counts[] = {4, 4, 1, 0};
+	for(unsigned i = 0u; i < 4; ++i) {
+		unsigned before = expired;
+		pml_iterate(pml, false);
+		assert(expired - before == counts[i]);
+	}
+
+	printf("calls: %u, expired: %u\n", calls, expired);
+	for(unsigned i = 0u; i < N_TIMERS; ++i) {
+		pml_timer_destroy(timers[i]);
+	}
+	pml_timer_destroy(other);
+	pml_timer_group_destroy(group);
+	pml_destroy(pml);
+}
@@ -0,0 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+unsigned count = 0u;
+int order[5];
+struct pml_timer* timers[5];
+
+void timer_cb(struct pml_timer* t) {
+	int id = (int) (size_t) pml_timer_get_data(t);
+	printf("timer %d\n", id);
+	order[count++] = id;
+
+	// destroying a timer that is already expired but wasn't dispatched
+	// yet must prevent it from being dispatched
+	if(id == 2) {
+		pml_timer_destroy(timers[0]);
+	}
+}
+
+void run(enum pml_timer_storage storage) {
+	struct pml* pml = pml_new();
+	pml_set_timer_storage(pml, storage);
+	count = 0u;
+
+	// all in the past, created in reverse deadline order
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for(int i = 0; i < 5; ++i) {
+		struct timespec time = now;
+		time.tv_sec -= 10 + i;
+		timers[i] = pml_timer_new(pml, &time, timer_cb);
+		pml_timer_set_data(timers[i], (void*) (size_t) i);
+	}
+
+	pml_set_timer_dispatch_limit(pml, 2);
+	pml_iterate(pml, false);
+	assert(count == 2);
+	assert(order[0] == 4 && order[1] == 3);
+
+	pml_set_timer_dispatch_limit(pml, 0);
+	pml_iterate(pml, false);
+	assert(count == 4);
+	assert(order[2] == 2 && order[3] == 1);
+
+	// timers in the future and disabled lazy ones don't expire
+	struct timespec time = now;
+	time.tv_sec += 100;
+	pml_timer_set_time(timers[1], time);
+	pml_timer_set_lazy(timers[2], true);
+	pml_timer_set_time(timers[2], now);
+	pml_timer_disable(timers[2]);
+	pml_iterate(pml, false);
+	assert(count == 4);
+
+	pml_destroy(pml);
+}
+
+int main() {
+	run(pml_timer_storage_heap);
+	run(pml_timer_storage_flat);
+}
@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pml.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+#include <poll.h>
+
+#define NS_PER_SEC 1000000000l
+
+unsigned fired = 0u;
+
+void timer_cb(struct pml_timer* t) {
+	++fired;
+}
+
+bool equal(struct timespec a, struct timespec b) {
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+void round_trip(struct pml_timer* timer, struct timespec time) {
+	pml_timer_set_time(timer, time);
+	struct timespec got = pml_timer_get_time(timer);
+	assert(equal(got, time));
+}
+
+int main() {
+	struct pml* pml = pml_new();
+	struct pml_timer* timer = pml_timer_new(pml, NULL, timer_cb);
+	pml_timer_set_clock(timer, CLOCK_MONOTONIC);
+
+	// normalized values round-trip exactly
+	round_trip(timer, (struct timespec) {0, 0});
+	round_trip(timer, (struct timespec) {5, NS_PER_SEC - 1});
+	round_trip(timer, (struct timespec) {-1, NS_PER_SEC - 1});
+	round_trip(timer, (struct timespec) {-2, 1});
+
+	// largest values that still fit into int64 nanoseconds
+	round_trip(timer, (struct timespec) {INT64_MAX / NS_PER_SEC - 1,
+		NS_PER_SEC - 1});
+	round_trip(timer, (struct timespec) {INT64_MAX / NS_PER_SEC,
+		INT64_MAX % NS_PER_SEC});
+	round_trip(timer, (struct timespec) {INT64_MIN / NS_PER_SEC - 1,
+		NS_PER_SEC + INT64_MIN % NS_PER_SEC});
+
+	// tv_nsec >= 1e9 is normalized
+	pml_timer_set_time(timer, (struct timespec) {3, NS_PER_SEC + 5});
+	struct timespec got = pml_timer_get_time(timer);
+	assert(equal(got, ((struct timespec) {4, 5})));
+
+	// beyond the int64 range, the deadline saturates
+	struct timespec max = {INT64_MAX / NS_PER_SEC, INT64_MAX % NS_PER_SEC};
+	pml_timer_set_time(timer, (struct timespec) {max.tv_sec,
+		max.tv_nsec + 1});
+	assert(equal(pml_timer_get_time(timer), max));
+	pml_timer_set_time(timer, (struct timespec) {max.tv_sec + 1, 0});
+	assert(equal(pml_timer_get_time(timer), max));
+	if(sizeof(time_t) >= sizeof(int64_t)) {
+		pml_timer_set_time(timer, (struct timespec) {INT64_MAX, NS_PER_SEC - 1});
+		assert(equal(pml_timer_get_time(timer), max));
+	}
+
+	// such a timer never expires, poll gets the largest possible timeout
+	pml_iterate(pml, false);
+	assert(fired == 0);
+
+	struct pollfd fds[8];
+	int timeout;
+	pml_prepare(pml);
+	unsigned n = pml_query(pml, fds, 8, &timeout);
+	assert(n <= 8);
+	assert(timeout == INT_MAX);
+	for(unsigned i = 0u; i < n; ++i) {
+		fds[i].revents = 0;
+	}
+	pml_poll(pml, 0);
+	pml_dispatch(pml, fds, n);
+	assert(fired == 0);
+
+	// relative times: tv_nsec close to 1e9 is normalized
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int res = pml_timer_set_time_rel(timer, (struct timespec) {0,
+		NS_PER_SEC - 1});
+	assert(res == 0);
+	got = pml_timer_get_time(timer);
+	assert(got.tv_nsec >= 0 && got.tv_nsec < NS_PER_SEC);
+	int64_t diff = (got.tv_sec - now.tv_sec) * NS_PER_SEC +
+		(got.tv_nsec - now.tv_nsec);
+	assert(diff >= NS_PER_SEC - 1 && diff < 2 * NS_PER_SEC);
+
+	// huge relative times saturate as well
+	res = pml_timer_set_time_rel(timer, (struct timespec) {max.tv_sec, 0});
+	assert(res == 0);
+	assert(equal(pml_timer_get_time(timer), max));
+	pml_iterate(pml, false);
+	assert(fired == 0);
+
+	// deadlines far in the past expire
+	pml_timer_set_time(timer, (struct timespec) {INT64_MIN / NS_PER_SEC, 0});
+	pml_iterate(pml, false);
+	assert(fired == 1);
+
+	pml_timer_destroy(timer);
+	pml_destroy(pml);
+}
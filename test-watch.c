@@ -0,0 +1,133 @@
+#define _DEFAULT_SOURCE // mkdtemp
+
+#include <pml.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define N_EXTRA 20
+
+char dir[64];
+char extra_paths[N_EXTRA][96];
+struct pml_watch* extra[N_EXTRA];
+unsigned n_extra = 0u;
+
+// per dir watch: number of IN_CREATE/IN_MODIFY/IN_DELETE events for "a"
+unsigned created[2];
+unsigned modified[2];
+unsigned deleted[2];
+
+unsigned file_modified = 0u;
+unsigned file_ignored = 0u;
+struct pml_watch* file_watch;
+
+void extra_cb(struct pml_watch* w, unsigned mask, unsigned cookie,
+		const char* name) {
+}
+
+void dir_cb(struct pml_watch* w, unsigned mask, unsigned cookie,
+		const char* name) {
+	unsigned id = *(unsigned*) pml_watch_get_data(w);
+	assert(name && strcmp(name, "a") == 0);
+	if(mask & IN_CREATE) {
+		++created[id];
+
+		// creating enough watches to require a rehash while the
+		// bucket of this event is walked
+		for(; n_extra < N_EXTRA; ++n_extra) {
+			extra[n_extra] = pml_watch_new(pml_watch_get_pml(w),
+				extra_paths[n_extra], IN_MODIFY, extra_cb);
+			assert(extra[n_extra]);
+		}
+	}
+	if(mask & IN_MODIFY) {
+		++modified[id];
+	}
+	if(mask & IN_DELETE) {
+		++deleted[id];
+	}
+}
+
+void file_cb(struct pml_watch* w, unsigned mask, unsigned cookie,
+		const char* name) {
+	assert(w == file_watch);
+	assert(!name);
+	if(mask & IN_MODIFY) {
+		++file_modified;
+	}
+	if(mask & IN_IGNORED) {
+		++file_ignored;
+		pml_watch_destroy(w);
+		file_watch = NULL;
+	}
+}
+
+void iterate(struct pml* pml) {
+	for(unsigned i = 0u; i < 4; ++i) {
+		pml_iterate(pml, false);
+	}
+}
+
+int main() {
+	strcpy(dir, "/tmp/pml-test-watch-XXXXXX");
+	char* res = mkdtemp(dir);
+	assert(res);
+
+	for(unsigned i = 0u; i < N_EXTRA; ++i) {
+		snprintf(extra_paths[i], sizeof(extra_paths[i]), "%s/x%u", dir, i);
+		int fd = open(extra_paths[i], O_CREAT | O_WRONLY, 0600);
+		assert(fd >= 0);
+		close(fd);
+	}
+
+	// the same directory watched twice, sharing the wd
+	struct pml* pml = pml_new();
+	unsigned ids[2] = {0, 1};
+	struct pml_watch* dir_watches[2];
+	for(unsigned i = 0u; i < 2; ++i) {
+		dir_watches[i] = pml_watch_new(pml, dir,
+			IN_CREATE | IN_MODIFY | IN_DELETE, dir_cb);
+		assert(dir_watches[i]);
+		pml_watch_set_data(dir_watches[i], &ids[i]);
+	}
+
+	char path[96];
+	snprintf(path, sizeof(path), "%s/a", dir);
+	int fd = open(path, O_CREAT | O_WRONLY, 0600);
+	assert(fd >= 0);
+	iterate(pml);
+	assert(n_extra == N_EXTRA);
+	assert(created[0] == 1 && created[1] == 1);
+
+	file_watch = pml_watch_new(pml, path, IN_MODIFY, file_cb);
+	assert(file_watch);
+	assert(pml_watch_get_mask(file_watch) == IN_MODIFY);
+	ssize_t written = write(fd, "x", 1);
+	assert(written == 1);
+	close(fd);
+	iterate(pml);
+	assert(modified[0] == 1 && modified[1] == 1);
+	assert(file_modified == 1);
+
+	// the file watch is destroyed from its callback on IN_IGNORED
+	unlink(path);
+	iterate(pml);
+	assert(deleted[0] == 1 && deleted[1] == 1);
+	assert(file_ignored == 1 && !file_watch);
+	assert(created[0] == 1 && created[1] == 1);
+
+	for(unsigned i = 0u; i < N_EXTRA; ++i) {
+		pml_watch_destroy(extra[i]);
+		unlink(extra_paths[i]);
+	}
+	for(unsigned i = 0u; i < 2; ++i) {
+		pml_watch_destroy(dir_watches[i]);
+	}
+
+	pml_destroy(pml);
+	rmdir(dir);
+}